@@ -0,0 +1,225 @@
+#include "MMLCompileCache.h"
+#include "MMLParser/MMLLexer.h"
+#include <algorithm>
+
+namespace MMLPlugin {
+
+namespace
+{
+    constexpr juce::uint64 prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr juce::uint64 prime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr juce::uint64 prime3 = 0x165667B19E3779F9ULL;
+    constexpr juce::uint64 prime4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr juce::uint64 prime5 = 0x27D4EB2F165667C5ULL;
+
+    juce::uint64 rotateLeft(juce::uint64 value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    juce::uint64 round(juce::uint64 accumulator, juce::uint64 input)
+    {
+        accumulator += input * prime2;
+        return rotateLeft(accumulator, 31) * prime1;
+    }
+
+    juce::uint64 mergeRound(juce::uint64 accumulator, juce::uint64 value)
+    {
+        accumulator ^= round(0, value);
+        return accumulator * prime1 + prime4;
+    }
+}
+
+MMLCompileCache::MMLCompileCache(int maxScoresToRetain)
+    : maxRetainedScores(juce::jmax(1, maxScoresToRetain)),
+      hits(0),
+      misses(0)
+{
+}
+
+std::shared_ptr<const MMLCompiledScore> MMLCompileCache::find(std::string_view mmlText)
+{
+    const juce::ScopedLock scopedLock(lock);
+    const size_t index = findEntry(normalize(mmlText));
+
+    if (index < entries.size())
+    {
+        if (auto score = entries[index].score.lock())
+        {
+            moveToFront(index);
+            hits++;
+            return score;
+        }
+
+        entries.erase(entries.begin() + static_cast<std::ptrdiff_t>(index));
+    }
+
+    misses++;
+    return nullptr;
+}
+
+std::shared_ptr<const MMLCompiledScore> MMLCompileCache::insert(std::string_view mmlText, std::shared_ptr<const MMLCompiledScore> score)
+{
+    const juce::ScopedLock scopedLock(lock);
+    const juce::uint64 textHash = normalize(mmlText);
+    const size_t index = findEntry(textHash);
+
+    if (index < entries.size())
+    {
+        // Compiled concurrently by another instance: share the copy stored first
+        if (auto existing = entries[index].score.lock())
+            score = existing;
+        else
+            entries[index].score = score;
+
+        moveToFront(index);
+        return score;
+    }
+
+    entries.insert(entries.begin(), { textHash, normalizedText, score, nullptr });
+    moveToFront(0);
+    return score;
+}
+
+std::shared_ptr<const MMLProgram> MMLCompileCache::shareProgram(const MMLProgram& program)
+{
+    const juce::uint64 programHash = hash(program.getData(), program.getSize());
+    const juce::ScopedLock scopedLock(lock);
+
+    // Programs no score holds any more are dropped as the store is searched
+    programEntries.erase(std::remove_if(programEntries.begin(), programEntries.end(),
+                                        [] (const ProgramEntry& entry) { return entry.program.expired(); }),
+                         programEntries.end());
+
+    for (const ProgramEntry& entry : programEntries)
+    {
+        if (entry.hash != programHash)
+            continue;
+
+        auto stored = entry.program.lock();
+
+        if (stored != nullptr && std::equal(stored->getData(), stored->getData() + stored->getSize(),
+                                            program.getData(), program.getData() + program.getSize()))
+            return stored;
+    }
+
+    auto stored = std::make_shared<const MMLProgram>(program);
+    programEntries.push_back({ programHash, stored });
+    return stored;
+}
+
+void MMLCompileCache::clear()
+{
+    const juce::ScopedLock scopedLock(lock);
+    entries.clear();
+    programEntries.clear();
+}
+
+MMLCompileCache::Statistics MMLCompileCache::getStatistics() const
+{
+    const juce::ScopedLock scopedLock(lock);
+
+    Statistics statistics;
+    statistics.hits = hits;
+    statistics.misses = misses;
+    statistics.numScores = static_cast<int>(entries.size());
+    statistics.numPrograms = static_cast<int>(std::count_if(programEntries.begin(), programEntries.end(),
+                                                            [] (const ProgramEntry& entry) { return ! entry.program.expired(); }));
+    return statistics;
+}
+
+juce::uint64 MMLCompileCache::normalize(std::string_view mmlText)
+{
+    MMLLexer::normalizeWhitespace(mmlText, normalizedText);
+    return hash(normalizedText.data(), normalizedText.size());
+}
+
+size_t MMLCompileCache::findEntry(juce::uint64 textHash) const
+{
+    for (size_t i = 0; i < entries.size(); ++i)
+        if (entries[i].hash == textHash && entries[i].normalizedText == normalizedText)
+            return i;
+
+    return entries.size();
+}
+
+void MMLCompileCache::moveToFront(size_t index)
+{
+    std::rotate(entries.begin(), entries.begin() + static_cast<std::ptrdiff_t>(index),
+                entries.begin() + static_cast<std::ptrdiff_t>(index) + 1);
+
+    Entry& front = entries.front();
+
+    if (front.retained == nullptr)
+        front.retained = front.score.lock();
+
+    // Older entries stay findable only while some instance still holds their score
+    for (size_t i = static_cast<size_t>(maxRetainedScores); i < entries.size();)
+    {
+        entries[i].retained = nullptr;
+
+        if (entries[i].score.expired())
+            entries.erase(entries.begin() + static_cast<std::ptrdiff_t>(i));
+        else
+            ++i;
+    }
+}
+
+juce::uint64 MMLCompileCache::hash(const void* data, size_t size, juce::uint64 seed)
+{
+    const auto* bytes = static_cast<const juce::uint8*>(data);
+    const juce::uint8* const end = bytes + size;
+    juce::uint64 result;
+
+    if (size >= 32)
+    {
+        // Four independent lanes over 32-byte stripes
+        juce::uint64 lane1 = seed + prime1 + prime2;
+        juce::uint64 lane2 = seed + prime2;
+        juce::uint64 lane3 = seed;
+        juce::uint64 lane4 = seed - prime1;
+
+        for (; bytes + 32 <= end; bytes += 32)
+        {
+            lane1 = round(lane1, juce::ByteOrder::littleEndianInt64(bytes));
+            lane2 = round(lane2, juce::ByteOrder::littleEndianInt64(bytes + 8));
+            lane3 = round(lane3, juce::ByteOrder::littleEndianInt64(bytes + 16));
+            lane4 = round(lane4, juce::ByteOrder::littleEndianInt64(bytes + 24));
+        }
+
+        result = rotateLeft(lane1, 1) + rotateLeft(lane2, 7) + rotateLeft(lane3, 12) + rotateLeft(lane4, 18);
+        result = mergeRound(result, lane1);
+        result = mergeRound(result, lane2);
+        result = mergeRound(result, lane3);
+        result = mergeRound(result, lane4);
+    }
+    else
+    {
+        result = seed + prime5;
+    }
+
+    result += static_cast<juce::uint64>(size);
+
+    for (; bytes + 8 <= end; bytes += 8)
+        result = rotateLeft(result ^ round(0, juce::ByteOrder::littleEndianInt64(bytes)), 27) * prime1 + prime4;
+
+    if (bytes + 4 <= end)
+    {
+        result = rotateLeft(result ^ (static_cast<juce::uint64>(juce::ByteOrder::littleEndianInt(bytes)) * prime1), 23) * prime2 + prime3;
+        bytes += 4;
+    }
+
+    for (; bytes < end; ++bytes)
+        result = rotateLeft(result ^ (*bytes * prime5), 11) * prime1;
+
+    // Final avalanche
+    result ^= result >> 33;
+    result *= prime2;
+    result ^= result >> 29;
+    result *= prime3;
+    result ^= result >> 32;
+
+    return result;
+}
+
+} // namespace MMLPlugin
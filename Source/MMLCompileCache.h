@@ -0,0 +1,123 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MMLPlayback/MMLCompiledSequence.h"
+
+namespace MMLPlugin {
+
+/**
+ * MMLCompileCache - Process-wide store of compiled scores, keyed by their source text
+ *
+ * One instance is shared by every plugin instance in the process (hold it with a
+ * juce::SharedResourcePointer), so a score used by many instances is compiled and
+ * stored once: memory grows with the number of different scores, not of instances.
+ *
+ * Texts are compared in the canonical form given by MMLLexer::normalizeWhitespace(),
+ * so reindenting or re-wrapping a score still finds it. Lookups hash that form with
+ * XXH64 and only compare the full text of an entry with the same hash.
+ *
+ * A score stays in the store as long as any instance still holds it. On top of that,
+ * the most recently used ones are kept alive by the store itself, so that going back
+ * to an earlier version of a score does not compile it again. Only successful
+ * compiles are stored.
+ *
+ * The track programs of streamed scores are also stored one per track, keyed by their
+ * bytecode, so a track that several scores have in common (such as an unchanged part
+ * in an edited score, or a phrase shared between instances) is held once. A program
+ * stays stored as long as any score holds it.
+ *
+ * Threading: every member function is thread-safe.
+ */
+class MMLCompileCache
+{
+public:
+    /** Lookup counters since the store was created. */
+    struct Statistics
+    {
+        juce::uint64 hits = 0;
+        juce::uint64 misses = 0;
+        int numScores = 0;   // Distinct scores currently stored
+        int numPrograms = 0; // Distinct track programs currently stored
+    };
+
+    /**
+     * Creates an empty store.
+     * @param maxRetainedScores Number of recently used scores kept even when no instance holds them.
+     */
+    explicit MMLCompileCache(int maxRetainedScores = 16);
+
+    /**
+     * Looks up the compiled form of a score, counting a hit or a miss.
+     * @param mmlText UTF-8 encoded MML text.
+     * @return The compiled score, or nullptr if the score is not stored.
+     */
+    std::shared_ptr<const MMLCompiledScore> find(std::string_view mmlText);
+
+    /**
+     * Stores the compiled form of a score as the most recently used entry.
+     * If another thread stored the same score first, that copy is kept and returned,
+     * so every holder shares one.
+     * @param mmlText UTF-8 encoded MML text the score was compiled from.
+     * @param score The compiled score.
+     * @return The stored copy of the score, to use instead of the one passed in.
+     */
+    std::shared_ptr<const MMLCompiledScore> insert(std::string_view mmlText, std::shared_ptr<const MMLCompiledScore> score);
+
+    /**
+     * Gets the stored copy of a track program, storing this one first if no score holds
+     * a program with the same bytecode.
+     * @param program Compiled track program.
+     * @return The stored copy, for the score to hold instead of its own.
+     */
+    std::shared_ptr<const MMLProgram> shareProgram(const MMLProgram& program);
+
+    /** Forgets every entry (scores still held elsewhere stay alive; the counters are kept). */
+    void clear();
+
+    /** Gets the lookup counters. */
+    Statistics getStatistics() const;
+
+    /**
+     * Computes the XXH64 hash of a byte buffer.
+     * @param data Bytes to hash.
+     * @param size Number of bytes.
+     * @param seed Hash seed.
+     * @return 64-bit hash.
+     */
+    static juce::uint64 hash(const void* data, size_t size, juce::uint64 seed = 0);
+
+private:
+    struct Entry
+    {
+        juce::uint64 hash;
+        std::string normalizedText;
+        std::weak_ptr<const MMLCompiledScore> score;      // Alive while anyone holds the score
+        std::shared_ptr<const MMLCompiledScore> retained; // Set for the most recently used entries only
+    };
+
+    struct ProgramEntry
+    {
+        juce::uint64 hash;
+        std::weak_ptr<const MMLProgram> program; // Alive while any score holds the program
+    };
+
+    juce::uint64 normalize(std::string_view mmlText);
+    size_t findEntry(juce::uint64 textHash) const;
+    void moveToFront(size_t index);
+
+    juce::CriticalSection lock;
+    std::vector<Entry> entries; // Most recently used first
+    std::vector<ProgramEntry> programEntries;
+    int maxRetainedScores;
+    std::string normalizedText; // Canonical form of the last text looked up, reused between calls
+    juce::uint64 hits;
+    juce::uint64 misses;
+
+    JUCE_DECLARE_NON_COPYABLE (MMLCompileCache)
+};
+
+} // namespace MMLPlugin
@@ -0,0 +1,76 @@
+#include "MMLCompileWorker.h"
+
+namespace MMLPlugin {
+
+MMLCompileWorker::MMLCompileWorker(CompileFunction compileFunction)
+    : juce::Thread("MML compiler"),
+      compile(std::move(compileFunction)),
+      hasPendingRequest(false),
+      cancelRequested(false)
+{
+    startThread();
+}
+
+MMLCompileWorker::~MMLCompileWorker()
+{
+    signalThreadShouldExit();
+    cancelRequested = true;
+    requestAvailable.signal();
+    stopThread(5000);
+}
+
+void MMLCompileWorker::submit(const juce::String& mmlText, bool startPlayback)
+{
+    {
+        const juce::ScopedLock lock(requestLock);
+
+        // A Convert that never started compiling still has to start playback once newer text compiles
+        const bool playbackStillRequested = hasPendingRequest && pendingRequest.startPlayback;
+
+        pendingRequest.mmlText = mmlText;
+        pendingRequest.startPlayback = startPlayback || playbackStillRequested;
+        hasPendingRequest = true;
+
+        // Abandon whatever is compiling now; the flag is cleared when the next request is taken
+        cancelRequested = true;
+    }
+
+    requestAvailable.signal();
+}
+
+void MMLCompileWorker::run()
+{
+    while (! threadShouldExit())
+    {
+        requestAvailable.wait(-1);
+
+        Request request;
+
+        {
+            const juce::ScopedLock lock(requestLock);
+
+            if (! hasPendingRequest)
+                continue;
+
+            request = pendingRequest;
+            hasPendingRequest = false;
+            cancelRequested = false;
+        }
+
+        if (threadShouldExit())
+            break;
+
+        const bool completed = compile(request, cancelRequested);
+
+        if (! completed && request.startPlayback)
+        {
+            // The Convert was abandoned before it could start playback, so the request that replaced it does so
+            const juce::ScopedLock lock(requestLock);
+
+            if (hasPendingRequest)
+                pendingRequest.startPlayback = true;
+        }
+    }
+}
+
+} // namespace MMLPlugin
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <functional>
+
+namespace MMLPlugin {
+
+/**
+ * MMLCompileWorker - Compiles MML on a background thread
+ *
+ * Only the most recent request matters: submitting a new one replaces any
+ * request still waiting and raises the cancel flag, so a compile already in
+ * progress stops at its next check and the newer text is compiled instead.
+ * The message thread never waits for a compile.
+ */
+class MMLCompileWorker : private juce::Thread
+{
+public:
+    struct Request
+    {
+        juce::String mmlText;
+        bool startPlayback = false; // Start a preview once compiled (Convert button)
+    };
+
+    /**
+     * Called on the worker thread; should give up early once cancelFlag is raised.
+     * Returns false only if it gave up that way, before starting any playback.
+     */
+    using CompileFunction = std::function<bool (const Request& request, const std::atomic<bool>& cancelFlag)>;
+
+    explicit MMLCompileWorker(CompileFunction compileFunction);
+    ~MMLCompileWorker() override;
+
+    /**
+     * Queues MML text for compilation, superseding any earlier request.
+     * @param mmlText MML text to compile.
+     * @param startPlayback True to start a preview when the compile succeeds.
+     */
+    void submit(const juce::String& mmlText, bool startPlayback);
+
+private:
+    void run() override;
+
+    CompileFunction compile;
+
+    juce::CriticalSection requestLock;
+    Request pendingRequest;
+    bool hasPendingRequest;
+    std::atomic<bool> cancelRequested;
+    juce::WaitableEvent requestAvailable;
+
+    JUCE_DECLARE_NON_COPYABLE (MMLCompileWorker)
+};
+
+} // namespace MMLPlugin
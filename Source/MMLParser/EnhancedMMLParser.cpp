@@ -1,546 +1,325 @@
 #include "EnhancedMMLParser.h"
-#include <climits>
 #include <algorithm>
 
-EnhancedMMLParser::MMLNote::MMLNote()
-    : noteName('c'), accidental(0), octave(4), duration(0.25), isTied(false), timestamp(0.0) {}
+namespace
+{
+    /**
+     * Merges per-track sequences that are each in tick order into one, without allocating
+     * beyond the capacity of the output. Ties go to the earlier track, which keeps the
+     * output deterministic.
+     * @param numTracks Number of tracks (at most EnhancedMMLParser::maxTracks).
+     * @param getTrack Returns the sequence of a track, given its index.
+     * @param merged Receives the merged sequence (appended).
+     */
+    template <typename Event, typename GetTrack>
+    void mergeByTick(int numTracks, GetTrack getTrack, std::vector<Event>& merged)
+    {
+        struct MergeHead
+        {
+            juce::int64 tick;
+            int track;
+        };
+        
+        // Every track is already in order, so only the next event of each is compared
+        auto comesLater = [] (const MergeHead& a, const MergeHead& b)
+        {
+            return a.tick != b.tick ? a.tick > b.tick : a.track > b.track;
+        };
+        
+        MergeHead heads[EnhancedMMLParser::maxTracks];
+        size_t nextEvent[EnhancedMMLParser::maxTracks] = {};
+        int numHeads = 0;
+        
+        for (int i = 0; i < numTracks; i++)
+            if (!getTrack(i).empty())
+                heads[numHeads++] = { getTrack(i).front().tick, i };
+                
+        std::make_heap(heads, heads + numHeads, comesLater);
+        
+        while (numHeads > 0)
+        {
+            std::pop_heap(heads, heads + numHeads, comesLater);
+            MergeHead& head = heads[numHeads - 1];
+            const std::vector<Event>& track = getTrack(head.track);
+            size_t& next = nextEvent[head.track];
+            
+            merged.push_back(track[next++]);
+            
+            if (next < track.size())
+            {
+                head.tick = track[next].tick;
+                std::push_heap(heads, heads + numHeads, comesLater);
+            }
+            else
+            {
+                numHeads--;
+            }
+        }
+    }
+}
 
-EnhancedMMLParser::MMLLoop::MMLLoop()
-    : startPos(0), count(2) {}
+EnhancedMMLParser::EnhancedMMLParser()
+    : numTracks(0), reusingPrevious(false), trackSucceeded(), cancelFlag(nullptr), parallelTrackParsing(true)
+{
+}
 
-EnhancedMMLParser::ParseResult::ParseResult()
-    : totalDuration(0.0) {}
+EnhancedMMLParser::~EnhancedMMLParser()
+{
+}
 
-EnhancedMMLParser::ParseState::ParseState()
-    : position(0), octave(4), defaultDuration(0.25), tempo(120), volume(100), currentTime(0.0) {}
+bool EnhancedMMLParser::parse(const juce::String& mmlText)
+{
+    // JUCE strings are stored as UTF-8, so this is a view of the existing buffer
+    return parse(std::string_view(mmlText.toRawUTF8(), mmlText.getNumBytesAsUTF8()));
+}
 
+bool EnhancedMMLParser::parse(std::string_view mmlText)
+{
+    return parseTracks(mmlText, false);
+}
 
-EnhancedMMLParser::EnhancedMMLParser()
+bool EnhancedMMLParser::reparse(const juce::String& mmlText)
 {
-    noteToMidiMap['c'] = 0;
-    noteToMidiMap['d'] = 2;
-    noteToMidiMap['e'] = 4;
-    noteToMidiMap['f'] = 5;
-    noteToMidiMap['g'] = 7;
-    noteToMidiMap['a'] = 9;
-    noteToMidiMap['b'] = 11;
+    return reparse(std::string_view(mmlText.toRawUTF8(), mmlText.getNumBytesAsUTF8()));
 }
 
-EnhancedMMLParser::~EnhancedMMLParser()
+bool EnhancedMMLParser::reparse(std::string_view mmlText)
 {
+    return parseTracks(mmlText, true);
 }
 
-bool EnhancedMMLParser::parse(const juce::String& mmlText)
+bool EnhancedMMLParser::parseTracks(std::string_view mmlText, bool reusePrevious)
 {
-    ParseState state;
-    parseResult = ParseResult();
     errorMessage = "";
+    numTracks = 0;
     
-    if (mmlText.isEmpty())
+    if (mmlText.empty())
     {
         errorMessage = "Empty MML text";
         return false;
     }
     
-    while (state.position < mmlText.length())
+    MMLLexer::splitTracks(mmlText, trackRanges);
+    
+    if (static_cast<int>(trackRanges.size()) > maxTracks)
     {
-        char c = mmlText[state.position];
+        // Point at the separator that starts the first track too many
+        errorMessage = "Too many tracks (max " + juce::String(maxTracks) + ") at position "
+                     + juce::String(trackRanges[maxTracks].offset - 1);
+        return false;
+    }
+    
+    while (tracks.size() < trackRanges.size())
+        tracks.push_back(std::make_unique<MMLTrackParser>());
         
-        if (juce::CharacterFunctions::isWhitespace(c))
-        {
-            state.position++;
-            continue;
-        }
+    parseText = mmlText;
+    reusingPrevious = reusePrevious;
+    std::fill(std::begin(trackSucceeded), std::end(trackSucceeded), false);
+    
+    // Unchanged tracks only need their offset updated, so only edited ones go to the workers
+    int changedTracks[maxTracks];
+    int numChangedTracks = 0;
+    
+    for (int i = 0; i < static_cast<int>(trackRanges.size()); i++)
+    {
+        const MMLLexer::TrackRange& range = trackRanges[static_cast<size_t>(i)];
         
-        switch (c)
-        {
-            case 'c':
-            case 'd':
-            case 'e':
-            case 'f':
-            case 'g':
-            case 'a':
-            case 'b':
-                if (!parseNote(state, mmlText, parseResult))
-                    return false;
-                break;
-                
-            case 'r':
-                if (!parseRest(state, mmlText, parseResult))
-                    return false;
-                break;
-                
-            case 'o':
-                if (!parseOctave(state, mmlText))
-                    return false;
-                break;
-                
-            case '>':
-                state.octave = juce::jmin(state.octave + 1, 8);
-                state.position++;
-                break;
-                
-            case '<':
-                state.octave = juce::jmax(state.octave - 1, 0);
-                state.position++;
-                break;
-                
-            case 'l':
-                if (!parseDuration(state, mmlText))
-                    return false;
-                break;
-                
-            case 't':
-                if (!parseTempo(state, mmlText))
-                    return false;
-                break;
-                
-            case 'v':
-                if (!parseVolume(state, mmlText))
-                    return false;
-                break;
-                
-            case '[':
-                if (!parseLoop(state, mmlText, parseResult))
-                    return false;
-                break;
-                
-            case ']':
-                if (!parseEndLoop(state, mmlText, parseResult))
-                    return false;
-                break;
-                
-            default:
-                state.position++;
-                break;
-        }
+        if (reusePrevious && tracks[static_cast<size_t>(i)]->isUpToDate(mmlText.substr(range.offset, range.length)))
+            parseTrack(i);
+        else
+            changedTracks[numChangedTracks++] = i;
     }
     
-    parseResult.totalDuration = state.currentTime;
-    
-    return true;
-}
-
-juce::MidiMessageSequence EnhancedMMLParser::generateMidi()
-{
-    juce::MidiMessageSequence sequence;
-
-    for (const auto& note : parseResult.notes)
+    if (numChangedTracks > 1 && parallelTrackParsing)
     {
-        if (note.noteName == 'r')
-            continue;
+        if (trackPool == nullptr)
+        {
+            for (int i = 0; i < maxTracks; i++)
+                trackJobs.push_back(std::make_unique<TrackJob>(*this, i));
+                
+            trackPool = std::make_unique<juce::SharedResourcePointer<SharedTrackPool>>();
+        }
         
-        int midiNote = noteNameToMidiNote(note.noteName, note.accidental, note.octave);
+        juce::ThreadPool& pool = (*trackPool)->pool;
         
-        double onTime = note.timestamp;
-        double offTime = note.timestamp + note.duration;
+        // Tracks share nothing while parsing; this thread takes the first one itself
+        for (int i = 1; i < numChangedTracks; i++)
+        {
+            TrackJob* job = trackJobs[static_cast<size_t>(changedTracks[i])].get();
+            job->reset();
+            pool.addJob(job, false);
+        }
         
-        juce::MidiMessage noteOn = juce::MidiMessage::noteOn(1, midiNote, (juce::uint8)100);
-        noteOn.setTimeStamp(onTime);
-        sequence.addEvent(noteOn);
+        parseTrack(changedTracks[0]);
         
-        if (!note.isTied)
+        // The pool is shared with every other parser in the process, so rather than wait for
+        // its threads to get round to them, this thread also parses the tracks nobody has started
+        for (int i = 1; i < numChangedTracks; i++)
         {
-            juce::MidiMessage noteOff = juce::MidiMessage::noteOff(1, midiNote);
-            noteOff.setTimeStamp(offTime);
-            sequence.addEvent(noteOff);
+            if (trackJobs[static_cast<size_t>(changedTracks[i])]->claim())
+                parseTrack(changedTracks[i]);
         }
+        
+        // Takes a job off the queue if it is still there, or waits for a worker that is running it,
+        // so it can be queued again by the next parse
+        for (int i = 1; i < numChangedTracks; i++)
+            pool.removeJob(trackJobs[static_cast<size_t>(changedTracks[i])].get(), false, -1);
+    }
+    else
+    {
+        for (int i = 0; i < numChangedTracks; i++)
+            parseTrack(changedTracks[i]);
     }
     
-    sequence.sort();
+    // Report the first failing track in score order, whichever thread finished first
+    for (int i = 0; i < static_cast<int>(trackRanges.size()); i++)
+    {
+        if (!trackSucceeded[i])
+        {
+            errorMessage = tracks[static_cast<size_t>(i)]->getError();
+            return false;
+        }
+    }
     
-    return sequence;
+    numTracks = static_cast<int>(trackRanges.size());
+    buildTempoMap();
+    
+    return true;
 }
 
-juce::String EnhancedMMLParser::getError() const
+void EnhancedMMLParser::parseTrack(int index)
 {
-    return errorMessage;
+    const MMLLexer::TrackRange& range = trackRanges[static_cast<size_t>(index)];
+    const std::string_view trackText = parseText.substr(range.offset, range.length);
+    MMLTrackParser& track = *tracks[static_cast<size_t>(index)];
+    
+    track.setCancelFlag(cancelFlag);
+    trackSucceeded[index] = reusingPrevious ? track.reparse(trackText, range.offset)
+                                            : track.parse(trackText, range.offset);
 }
 
-bool EnhancedMMLParser::parseNote(ParseState& state, const juce::String& text, ParseResult& result)
+void EnhancedMMLParser::buildTempoMap()
 {
-    char noteName = text[state.position++];
+    tempoChanges.clear();
     
-    int accidental = 0;
-    if (state.position < text.length())
-    {
-        if (text[state.position] == '+' || text[state.position] == '#')
-        {
-            accidental = 1;
-            state.position++;
-        }
-        else if (text[state.position] == '-')
-        {
-            accidental = -1;
-            state.position++;
-        }
-    }
+    // At the same tick, the change from the later track is added last and wins
+    mergeByTick(numTracks, [this] (int i) -> const std::vector<MMLTrackParser::TempoEvent>& {
+        return tracks[static_cast<size_t>(i)]->getTempoEvents();
+    }, tempoChanges);
     
-    double duration = state.defaultDuration;
-    if (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]))
-    {
-        duration = parseDurationValue(state, text, state.position);
-    }
+    tempoMap.reset();
     
-    if (state.position < text.length() && text[state.position] == '.')
-    {
-        duration *= 1.5;
-        state.position++;
-    }
-    
-    bool isTied = false;
-    if (state.position < text.length() && (text[state.position] == '&' || text[state.position] == '^'))
-    {
-        isTied = true;
-        state.position++;
-    }
-    
-    MMLNote note;
-    note.noteName = noteName;
-    note.accidental = accidental;
-    note.octave = state.octave;
-    note.duration = duration;
-    note.isTied = isTied;
-    note.timestamp = state.currentTime;
-    
-    result.notes.push_back(note);
+    for (const auto& change : tempoChanges)
+        tempoMap.addTempoChange(change.tick, change.tempo);
+}
+
+juce::MidiMessageSequence EnhancedMMLParser::generateMidi()
+{
+    std::vector<MMLMidiEvent> events;
+    generateEvents(events);
     
-    if (!isTied)
-    {
-        state.currentTime += duration;
-    }
+    juce::MidiMessageSequence sequence;
+    sequence.ensureStorageAllocated(static_cast<int>(events.size()));
     
-    return true;
+    // Ticks are converted to seconds only here, at the output stage
+    for (const auto& event : events)
+        sequence.addEvent(juce::MidiMessage(event.data[0], event.data[1], event.data[2],
+                                            tempoMap.tickToSeconds(event.tick)));
+                                            
+    return sequence;
 }
 
-bool EnhancedMMLParser::parseRest(ParseState& state, const juce::String& text, ParseResult& result)
+void EnhancedMMLParser::generateEvents(std::vector<MMLMidiEvent>& events)
 {
-    // Skip 'r'
-    state.position++;
+    events.clear();
     
-    // Parse note duration
-    double duration = state.defaultDuration;
-    if (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]))
+    if (numTracks == 1)
     {
-        duration = parseDurationValue(state, text, state.position);
+        tracks[0]->generateEvents(events, 1);
+        return;
     }
     
-    // Parse dotted note
-    if (state.position < text.length() && text[state.position] == '.')
+    trackEvents.resize(static_cast<size_t>(numTracks));
+    size_t totalEvents = 0;
+    
+    for (int i = 0; i < numTracks; i++)
     {
-        duration *= 1.5;
-        state.position++;
+        tracks[static_cast<size_t>(i)]->generateEvents(trackEvents[static_cast<size_t>(i)], i + 1);
+        totalEvents += trackEvents[static_cast<size_t>(i)].size();
     }
     
-    // Create rest note
-    MMLNote rest;
-    rest.noteName = 'r';
-    rest.duration = duration;
-    rest.timestamp = state.currentTime;
-    
-    // Add rest note
-    result.notes.push_back(rest);
+    events.reserve(totalEvents);
     
-    // Advance time
-    state.currentTime += duration;
-    
-    return true;
+    mergeByTick(numTracks, [this] (int i) -> const std::vector<MMLMidiEvent>& {
+        return trackEvents[static_cast<size_t>(i)];
+    }, events);
 }
 
-bool EnhancedMMLParser::parseOctave(ParseState& state, const juce::String& text)
+juce::String EnhancedMMLParser::getError() const
 {
-    // Skip 'o'
-    state.position++;
-    
-    // Parse octave number
-    if (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]))
-    {
-        char digitChar = text[state.position];
-        if (digitChar < '0' || digitChar > '9') {
-            errorMessage = "Invalid octave character at position " + juce::String(state.position);
-            return false;
-        }
-        int octave = digitChar - '0';
-        if (octave < 0 || octave > 8) {
-            errorMessage = "Octave out of range (0-8) at position " + juce::String(state.position);
+    return errorMessage;
+}
+
+bool EnhancedMMLParser::isExpanded() const
+{
+    for (int i = 0; i < numTracks; i++)
+        if (!tracks[static_cast<size_t>(i)]->isExpanded())
             return false;
-        }
-        state.octave = octave;
-        state.position++;
-        return true;
-    }
-    
-    errorMessage = "Invalid octave at position " + juce::String(state.position);
-    return false;
+            
+    return true;
 }
 
-bool EnhancedMMLParser::parseDuration(ParseState& state, const juce::String& text)
+int EnhancedMMLParser::getNumTracks() const
 {
-    // Skip 'l'
-    state.position++;
-    
-    // Parse note duration
-    if (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]))
-    {
-        state.defaultDuration = parseDurationValue(state, text, state.position);
-        
-        // Parse dotted note
-        if (state.position < text.length() && text[state.position] == '.')
-        {
-            state.defaultDuration *= 1.5;
-            state.position++;
-        }
-        
-        return true;
-    }
-    
-    errorMessage = "Invalid duration at position " + juce::String(state.position);
-    return false;
+    return numTracks;
 }
 
-bool EnhancedMMLParser::parseTempo(ParseState& state, const juce::String& text)
+const MMLProgram& EnhancedMMLParser::getProgram(int trackIndex) const
 {
-    // Skip 't'
-    state.position++;
-    
-    // Parse tempo value
-    if (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]))
-    {
-        int tempo = 0;
-        int digitCount = 0;
-        while (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]) && digitCount < 4)
-        {
-            int digit = text[state.position] - '0';
-            if (tempo > (INT_MAX - digit) / 10) {
-                errorMessage = "Tempo value overflow at position " + juce::String(state.position);
-                return false;
-            }
-            tempo = tempo * 10 + digit;
-            state.position++;
-            digitCount++;
-        }
-        
-        // Check tempo range
-        if (tempo >= 20 && tempo <= 300)
-        {
-            state.tempo = tempo;
-            return true;
-        }
-        
-        errorMessage = "Tempo out of range (20-300) at position " + juce::String(state.position);
-        return false;
-    }
-    
-    errorMessage = "Invalid tempo at position " + juce::String(state.position);
-    return false;
+    return tracks[static_cast<size_t>(trackIndex)]->getProgram();
 }
 
-bool EnhancedMMLParser::parseVolume(ParseState& state, const juce::String& text)
+const MMLTempoMap& EnhancedMMLParser::getTempoMap() const
 {
-    // Skip 'v'
-    state.position++;
-    
-    // Parse volume value
-    if (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]))
-    {
-        int volume = 0;
-        int digitCount = 0;
-        while (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]) && digitCount < 3)
-        {
-            int digit = text[state.position] - '0';
-            if (volume > (INT_MAX - digit) / 10) {
-                errorMessage = "Volume value overflow at position " + juce::String(state.position);
-                return false;
-            }
-            volume = volume * 10 + digit;
-            state.position++;
-            digitCount++;
-        }
-        
-        // Check volume range
-        if (volume >= 0 && volume <= 127)
-        {
-            state.volume = volume;
-            return true;
-        }
-        
-        errorMessage = "Volume out of range (0-127) at position " + juce::String(state.position);
-        return false;
-    }
-    
-    errorMessage = "Invalid volume at position " + juce::String(state.position);
-    return false;
+    return tempoMap;
 }
 
-bool EnhancedMMLParser::parseLoop(ParseState& state, const juce::String& text, ParseResult& result)
+void EnhancedMMLParser::setCancelFlag(const std::atomic<bool>* flag)
 {
-    // Skip '['
-    state.position++;
-    
-    // Save loop information
-    MMLLoop loop;
-    loop.startPos = state.position;
-    loop.count = 2; // Default is 2 times
-    
-    state.loops.push_back(loop);
-    
-    return true;
+    cancelFlag = flag;
 }
 
-bool EnhancedMMLParser::parseEndLoop(ParseState& state, const juce::String& text, ParseResult& result)
+void EnhancedMMLParser::setParallelTrackParsing(bool shouldParseInParallel)
 {
-    // Skip ']'
-    state.position++;
-    
-    // Ensure loop stack is not empty
-    if (state.loops.empty())
-    {
-        errorMessage = "Unmatched loop end at position " + juce::String(state.position);
-        return false;
-    }
-    
-    // Parse loop count
-    int count = 2; // デフォルト
-    if (state.position < text.length())
-    {
-        // If there is a number after '*'
-        if (text[state.position] == '*' && state.position + 1 < text.length() && 
-            juce::CharacterFunctions::isDigit(text[state.position + 1]))
-        {
-            state.position++;
-            while (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]))
-            {
-                count = count * 10 + (text[state.position] - '0');
-                state.position++;
-            }
-        }
-        // If there is a number directly
-        else if (juce::CharacterFunctions::isDigit(text[state.position]))
-        {
-            count = 0;
-            int digitCount = 0;
-            while (state.position < text.length() && juce::CharacterFunctions::isDigit(text[state.position]) && digitCount < 3)
-            {
-                int digit = text[state.position] - '0';
-                if (count > (INT_MAX - digit) / 10) {
-                    errorMessage = "Loop count overflow at position " + juce::String(state.position);
-                    return false;
-                }
-                count = count * 10 + digit;
-                state.position++;
-                digitCount++;
-            }
-        }
-    }
-    
-    // Check loop count range
-    if (count < 1 || count > 100)
-    {
-        errorMessage = "Loop count out of range (1-100) at position " + juce::String(state.position);
-        return false;
-    }
-    
-    // Get last loop information
-    MMLLoop& loop = state.loops.back();
-    loop.count = count;
-    
-    // Process loop (from the second time onward)
-    for (int i = 1; i < count; i++)
-    {
-        // Return to loop start position
-        int savedPosition = state.position;
-        state.position = loop.startPos;
-        
-        // Re-parse loop content
-        while (state.position < savedPosition - 1)
-        {
-            // Get current character
-            char c = text[state.position];
-            
-            // Parse command (except parseEndLoop)
-            switch (c)
-            {
-                case 'c':
-                case 'd':
-                case 'e':
-                case 'f':
-                case 'g':
-                case 'a':
-                case 'b':
-                    if (!parseNote(state, text, result))
-                        return false;
-                    break;
-                case 'r':
-                    if (!parseRest(state, text, result))
-                        return false;
-                    break;
-                case 'o':
-                    if (!parseOctave(state, text))
-                        return false;
-                    break;
-                case '>':
-                    state.octave = juce::jmin(state.octave + 1, 8);
-                    state.position++;
-                    break;
-                case '<':
-                    state.octave = juce::jmax(state.octave - 1, 0);
-                    state.position++;
-                    break;
-                case 'l':
-                    if (!parseDuration(state, text))
-                        return false;
-                    break;
-                case 't':
-                    if (!parseTempo(state, text))
-                        return false;
-                    break;
-                case 'v':
-                    if (!parseVolume(state, text))
-                        return false;
-                    break;
-                case '[':
-                    if (!parseLoop(state, text, result))
-                        return false;
-                    break;
-                default:
-                    state.position++;
-                    break;
-            }
-        }
+    parallelTrackParsing = shouldParseInParallel;
+}
+
+//==============================================================================
+EnhancedMMLParser::TrackJob::TrackJob(EnhancedMMLParser& parser, int index)
+    : juce::ThreadPoolJob("MML track parser"), owner(parser), trackIndex(index), claimed(false)
+{
+}
+
+juce::ThreadPoolJob::JobStatus EnhancedMMLParser::TrackJob::runJob()
+{
+    if (claim())
+        owner.parseTrack(trackIndex);
         
-        // Restore original position
-        state.position = savedPosition;
-    }
-    
-    // Remove from loop stack
-    state.loops.pop_back();
-    
-    return true;
+    return jobHasFinished;
 }
 
-double EnhancedMMLParser::parseDurationValue(ParseState& state, const juce::String& text, int& position)
+void EnhancedMMLParser::TrackJob::reset()
 {
-    // Parse denominator of note duration
-    int denominator = 0;
-    while (position < text.length() && juce::CharacterFunctions::isDigit(text[position]))
-    {
-        denominator = denominator * 10 + (text[position] - '0');
-        position++;
-    }
-    
-    // Use default value if denominator is 0
-    if (denominator == 0)
-        return state.defaultDuration;
-    
-    // Calculate note duration (quarter note = 1.0)
-    return 4.0 / denominator;
+    claimed.store(false);
 }
 
-int EnhancedMMLParser::noteNameToMidiNote(char noteName, int accidental, int octave)
+bool EnhancedMMLParser::TrackJob::claim()
+{
+    return !claimed.exchange(true);
+}
+
+//==============================================================================
+EnhancedMMLParser::SharedTrackPool::SharedTrackPool()
+    : pool(juce::jmax(1, juce::SystemStats::getNumCpus() - 1))
 {
-    // Get base note number from note name
-    int baseNote = noteToMidiMap[noteName];
-    
-    // Calculate MIDI note number (C4 = 60)
-    return baseNote + accidental + (octave + 1) * 12;
 }
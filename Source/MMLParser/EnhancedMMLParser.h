@@ -1,18 +1,37 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <string_view>
 #include <vector>
-#include <map>
+#include "MMLLexer.h"
+#include "MMLProgram.h"
+#include "MMLTrackParser.h"
+#include "MMLTempoMap.h"
+#include "MMLMidiEvent.h"
 
 /**
  * EnhancedMMLParser - Optimized for Cubase 14
  * 
  * This class parses Music Macro Language (MML) text and converts it into MIDI data.
  * Optimized to maximize compatibility with Cubase 14.
+ *
+ * A score can hold several tracks separated by ';'. Track N plays on MIDI
+ * channel N, and tempo commands in any track set the tempo of the whole score.
+ * Tracks are parsed in parallel, on a pool of threads shared by every parser in the
+ * process, and merged when the MIDI events are generated.
+ *
+ * A parser is meant to be kept and reused: every buffer it fills (tokens, commands,
+ * bytecode, notes, loop stacks, event lists) keeps its capacity between parses, so
+ * recompiling a score of similar size does not allocate.
  */
 class EnhancedMMLParser
 {
 public:
+    /** Maximum number of tracks in a score (one per MIDI channel). */
+    static constexpr int maxTracks = MMLMidiEvent::numChannels;
+    
     EnhancedMMLParser();
     ~EnhancedMMLParser();
     
@@ -23,62 +42,146 @@ public:
      */
     bool parse(const juce::String& mmlText);
     
+    /**
+     * Parses the given MML text from a contiguous UTF-8 buffer.
+     * @param mmlText The UTF-8 encoded MML text to parse.
+     * @return True if parsing succeeded, false otherwise.
+     */
+    bool parse(std::string_view mmlText);
+    
+    /**
+     * Parses an edited version of the previously parsed text, reusing as much of the
+     * last parse as possible: unchanged tracks are kept as they are, and edited tracks
+     * are reparsed incrementally (see MMLTrackParser::reparse()). The result is the
+     * same as parse().
+     * @param mmlText The edited MML text.
+     * @return True if parsing succeeded, false otherwise.
+     */
+    bool reparse(const juce::String& mmlText);
+    
+    /**
+     * Parses an edited version of the previously parsed text from a contiguous UTF-8 buffer.
+     * @param mmlText The UTF-8 encoded MML text.
+     * @return True if parsing succeeded, false otherwise.
+     * @see reparse(const juce::String&)
+     */
+    bool reparse(std::string_view mmlText);
+    
+    /**
+     * Checks whether the whole score was expanded into notes by the last successful parse.
+     * A score with a track too long to expand (see MMLTrackParser::maxExpandedNotes) is only
+     * compiled; it is played by running the track programs with an MMLEventStream, and
+     * generateMidi(), generateEvents() and getTempoMap() do not cover it.
+     * @return True if every track was expanded.
+     */
+    bool isExpanded() const;
+    
     /**
      * Generates a MIDI sequence from the parsed MML.
+     * Timestamps are in seconds, following the tempo changes in the score.
      * @return MIDI message sequence.
      */
     juce::MidiMessageSequence generateMidi();
     
+    /**
+     * Generates the parsed MML as a flat list of MIDI events on the tick timeline,
+     * in playback order (the same order as generateMidi()).
+     * @param events Receives the events (cleared first).
+     */
+    void generateEvents(std::vector<MMLMidiEvent>& events);
+    
     /**
      * Gets the error message after parsing.
      * @return Error message string.
      */
     juce::String getError() const;
+    
+    /**
+     * Gets the number of tracks in the last successful parse.
+     * @return Number of tracks (at least 1), or 0 if the last parse failed.
+     */
+    int getNumTracks() const;
+    
+    /**
+     * Gets the compiled bytecode of one track of the last successful parse.
+     * @param trackIndex Index of the track (0 for the first).
+     * @return Compiled program.
+     */
+    const MMLProgram& getProgram(int trackIndex = 0) const;
+    
+    /**
+     * Gets the tempo map of the last successful parse.
+     * @return Tempo map built from the score's tempo commands.
+     */
+    const MMLTempoMap& getTempoMap() const;
+    
+    /**
+     * Sets a flag that another thread can raise to abandon a parse in progress.
+     * A cancelled parse returns false with a "Compilation cancelled" error.
+     * @param flag Flag to poll, or nullptr to disable cancellation.
+     */
+    void setCancelFlag(const std::atomic<bool>* flag);
+    
+    /**
+     * Chooses whether the tracks of a score are parsed in parallel on the shared pool of
+     * worker threads (the default). Callers that already run several parsers at once on
+     * threads of their own can turn this off, so that every parse stays on its calling thread.
+     * @param shouldParseInParallel False to parse every track on the calling thread.
+     */
+    void setParallelTrackParsing(bool shouldParseInParallel);
 
 private:
-    struct MMLNote {
-        MMLNote();
-        char noteName;
-        int accidental;
-        int octave;
-        double duration;
-        bool isTied;
-        double timestamp;
-    };
-    struct MMLLoop {
-        MMLLoop();
-        int startPos;
-        int count;
-    };
-    struct ParseResult {
-        ParseResult();
-        std::vector<MMLNote> notes;
-        double totalDuration;
+    /**
+     * Parses one track on the pool; kept between parses, so queuing a track allocates nothing.
+     * A queued job can also be claimed by the parsing thread, so that a track waiting behind
+     * other parsers' work in the shared pool is parsed by whichever thread gets to it first.
+     */
+    class TrackJob : public juce::ThreadPoolJob
+    {
+    public:
+        TrackJob(EnhancedMMLParser& owner, int trackIndex);
+        JobStatus runJob() override;
+        
+        /** Makes the job parse its track again the next time it is claimed. */
+        void reset();
+        
+        /**
+         * Claims the job's track for the calling thread.
+         * @return True if the caller should parse the track, false if another thread already has.
+         */
+        bool claim();
+        
+    private:
+        EnhancedMMLParser& owner;
+        int trackIndex;
+        std::atomic<bool> claimed;
     };
-    struct ParseState {
-        ParseState();
-        int position;
-        int octave;
-        double defaultDuration;
-        int tempo;
-        int volume;
-        double currentTime;
-        std::vector<MMLLoop> loops;
+    
+    /** Worker threads shared by every parser in the process, held through juce::SharedResourcePointer. */
+    struct SharedTrackPool
+    {
+        SharedTrackPool();
+        
+        juce::ThreadPool pool;
     };
-
-    bool parseNote(ParseState& state, const juce::String& text, ParseResult& result);
-    bool parseRest(ParseState& state, const juce::String& text, ParseResult& result);
-    bool parseOctave(ParseState& state, const juce::String& text);
-    bool parseDuration(ParseState& state, const juce::String& text);
-    bool parseTempo(ParseState& state, const juce::String& text);
-    bool parseVolume(ParseState& state, const juce::String& text);
-    bool parseLoop(ParseState& state, const juce::String& text, ParseResult& result);
-    bool parseEndLoop(ParseState& state, const juce::String& text, ParseResult& result);
-    double parseDurationValue(ParseState& state, const juce::String& text, int& position);
-    int noteNameToMidiNote(char noteName, int accidental, int octave);
-
+    
+    bool parseTracks(std::string_view mmlText, bool reusePrevious);
+    void parseTrack(int index);
+    void buildTempoMap();
+    
     juce::String errorMessage;
-    ParseResult parseResult;
-    std::map<char, int> noteToMidiMap;
+    std::vector<std::unique_ptr<MMLTrackParser>> tracks; // Kept between parses for reparse()
+    std::vector<MMLLexer::TrackRange> trackRanges;
+    int numTracks;
+    std::vector<std::vector<MMLMidiEvent>> trackEvents;
+    std::vector<MMLTrackParser::TempoEvent> tempoChanges;
+    MMLTempoMap tempoMap;
+    std::string_view parseText;         // Score being parsed, while parseTracks() runs
+    bool reusingPrevious;               // parseTracks() was called by reparse()
+    bool trackSucceeded[maxTracks];
+    std::vector<std::unique_ptr<TrackJob>> trackJobs; // One per track; never left queued once a parse returns
+    std::unique_ptr<juce::SharedResourcePointer<SharedTrackPool>> trackPool; // Taken by the first parse with several tracks to do
+    const std::atomic<bool>* cancelFlag;
+    bool parallelTrackParsing;
 
 };
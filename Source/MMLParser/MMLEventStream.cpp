@@ -0,0 +1,241 @@
+#include "MMLEventStream.h"
+#include <algorithm>
+
+MMLEventStream::MMLEventStream()
+    : numTracks(0), sampleRate(44100.0), tempo(), event(), samplePosition(0), finished(true), includesTempoChanges(false)
+{
+}
+
+void MMLEventStream::setTracks(const MMLProgram* programs, int numPrograms, double newSampleRate)
+{
+    numTracks = std::min(numPrograms, MMLMidiEvent::numChannels);
+    sampleRate = newSampleRate;
+
+    for (int i = 0; i < numTracks; i++)
+        interpreters[i].emplace(programs[i]);
+
+    rewind();
+}
+
+void MMLEventStream::setTracks(const std::shared_ptr<const MMLProgram>* programs, int numPrograms, double newSampleRate)
+{
+    numTracks = std::min(numPrograms, MMLMidiEvent::numChannels);
+    sampleRate = newSampleRate;
+
+    for (int i = 0; i < numTracks; i++)
+        interpreters[i].emplace(*programs[i]);
+
+    rewind();
+}
+
+void MMLEventStream::rewind()
+{
+    for (int i = 0; i < numTracks; i++)
+    {
+        interpreters[i]->reset();
+        cursors[i].hasNoteOff = false;
+        pull(i);
+    }
+
+    tempo = MMLTempoMap::Segment::atStart(MMLTempoMap::defaultTempo);
+    advance();
+}
+
+void MMLEventStream::advance()
+{
+    finished = !fetch();
+
+    if (!finished)
+        samplePosition = tempo.tickToSample(event.tick, sampleRate);
+}
+
+bool MMLEventStream::fetch()
+{
+    for (;;)
+    {
+        // The track whose next event comes first; ties go to the earlier track, as in the expanded merge
+        int track = -1;
+        int64_t trackTick = 0;
+        bool isNoteOff = false;
+
+        for (int i = 0; i < numTracks; i++)
+        {
+            const TrackCursor& cursor = cursors[i];
+            const bool noteOffFirst = cursor.hasNoteOff && (!cursor.hasNext || cursor.noteOffTick <= cursor.next.tick);
+
+            if (!noteOffFirst && !cursor.hasNext)
+                continue;
+
+            const int64_t tick = noteOffFirst ? cursor.noteOffTick : cursor.next.tick;
+
+            if (track < 0 || tick < trackTick)
+            {
+                track = i;
+                trackTick = tick;
+                isNoteOff = noteOffFirst;
+            }
+        }
+
+        if (track < 0)
+            return false;
+
+        TrackCursor& cursor = cursors[track];
+        const auto channelBits = static_cast<uint8_t>(track);
+
+        if (isNoteOff)
+        {
+            event = { cursor.noteOffTick, { static_cast<uint8_t>(0x80 | channelBits), cursor.noteOffPitch, 0 } };
+            cursor.hasNoteOff = false;
+            return true;
+        }
+
+        const MMLInterpreter::Event next = cursor.next;
+        pull(track);
+
+        if (next.type == MMLInterpreter::Event::Type::Tempo)
+        {
+            tempo = tempo.withTempoChange(next.tick, next.value);
+
+            if (includesTempoChanges)
+            {
+                event = { next.tick, { tempoChangeStatus, 0, 0 } };
+                return true;
+            }
+
+            continue;
+        }
+
+        if (next.type != MMLInterpreter::Event::Type::Note)
+            continue;
+
+        const auto pitch = static_cast<uint8_t>(MMLInterpreter::midiNoteNumber(next.noteName, next.accidental, next.octave));
+        event = { next.tick, { static_cast<uint8_t>(0x90 | channelBits), pitch, MMLMidiEvent::noteOnVelocity } };
+
+        // A note that is not tied moves time to its end, so the next note of the track never
+        // starts before this note-off: one pending note-off per track is enough
+        if (!next.isTied)
+        {
+            cursor.hasNoteOff = true;
+            cursor.noteOffTick = next.tick + next.lengthTicks;
+            cursor.noteOffPitch = pitch;
+        }
+
+        return true;
+    }
+}
+
+void MMLEventStream::pull(int track)
+{
+    cursors[track].hasNext = interpreters[track]->next(cursors[track].next);
+}
+
+bool MMLEventStream::buildSeekTable(SeekTable& table, const std::atomic<bool>* cancelFlag)
+{
+    table.points.clear();
+    table.tracks.clear();
+    table.numTracks = numTracks;
+    table.interval = 1;
+    table.complete = true;
+
+    rewind();
+    int64_t index = 0;
+
+    while (!finished)
+    {
+        if (index % table.interval == 0)
+        {
+            // Keep the table a fixed size by dropping every other position and spacing new ones twice as far
+            if (table.points.size() == maxSeekPoints)
+            {
+                for (size_t i = 0; i < maxSeekPoints / 2; i++)
+                {
+                    table.points[i] = table.points[i * 2];
+                    std::copy_n(table.tracks.begin() + static_cast<std::ptrdiff_t>(i * 2 * static_cast<size_t>(numTracks)),
+                                numTracks, table.tracks.begin() + static_cast<std::ptrdiff_t>(i * static_cast<size_t>(numTracks)));
+                }
+
+                table.points.resize(maxSeekPoints / 2);
+                table.tracks.resize(maxSeekPoints / 2 * static_cast<size_t>(numTracks));
+                table.interval *= 2;
+            }
+
+            if (index % table.interval == 0)
+                savePoint(table);
+        }
+
+        if (index == maxIndexedEvents)
+        {
+            table.complete = false;
+            break;
+        }
+
+        if ((index & 4095) == 0 && cancelFlag != nullptr && cancelFlag->load(std::memory_order_relaxed))
+            return false;
+
+        advance();
+        index++;
+    }
+
+    table.numEvents = index;
+    rewind();
+    return true;
+}
+
+void MMLEventStream::seek(const SeekTable& table, int64_t position)
+{
+    if (table.points.empty())
+    {
+        rewind();
+        return;
+    }
+
+    // Last recorded position before the target; sample positions never decrease along the stream
+    auto pointSample = [this] (const SeekPoint& point) { return point.tempo.tickToSample(point.event.tick, sampleRate); };
+    auto after = std::partition_point(table.points.begin() + 1, table.points.end(),
+                                      [&] (const SeekPoint& point) { return pointSample(point) < position; });
+
+    restorePoint(table, static_cast<size_t>(after - table.points.begin()) - 1);
+
+    // At most one interval separates two recorded positions; going further means the
+    // target lies beyond the part of the stream the table covers
+    for (int64_t skipped = 0; !finished && samplePosition < position; skipped++)
+    {
+        if (skipped == table.interval)
+        {
+            finished = true;
+            break;
+        }
+
+        advance();
+    }
+}
+
+void MMLEventStream::savePoint(SeekTable& table) const
+{
+    table.points.push_back({ event, tempo });
+
+    for (int i = 0; i < numTracks; i++)
+    {
+        TrackPoint point;
+        interpreters[i]->save(point.interpreter);
+        point.cursor = cursors[i];
+        table.tracks.push_back(point);
+    }
+}
+
+void MMLEventStream::restorePoint(const SeekTable& table, size_t index)
+{
+    const SeekPoint& point = table.points[index];
+    const TrackPoint* trackPoints = table.tracks.data() + index * static_cast<size_t>(numTracks);
+
+    for (int i = 0; i < numTracks; i++)
+    {
+        interpreters[i]->restore(trackPoints[i].interpreter);
+        cursors[i] = trackPoints[i].cursor;
+    }
+
+    tempo = point.tempo;
+    event = point.event;
+    finished = false;
+    samplePosition = tempo.tickToSample(event.tick, sampleRate);
+}
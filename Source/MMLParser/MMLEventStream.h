@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "MMLProgram.h"
+#include "MMLInterpreter.h"
+#include "MMLMidiEvent.h"
+#include "MMLTempoMap.h"
+
+/**
+ * MMLEventStream - Plays compiled tracks by running their bytecode on demand
+ *
+ * Produces the same MIDI events, in the same order and at the same sample
+ * positions, as expanding the score with EnhancedMMLParser::generateEvents()
+ * and resolving them through its tempo map, but one event at a time. Loops are
+ * walked with each track's loop-counter stack, so memory use depends on the
+ * number of tracks, never on the length of the expanded score.
+ *
+ * Seeking continues from the nearest position recorded in a SeekTable, which
+ * holds a fixed maximum number of evenly spaced positions and is built once,
+ * off the audio thread. Apart from buildSeekTable(), nothing here allocates.
+ */
+class MMLEventStream
+{
+private:
+    struct TrackCursor
+    {
+        MMLInterpreter::Event next; // Next event from the interpreter, if hasNext
+        bool hasNext;
+        bool hasNoteOff;            // The last note's note-off, not yet reached
+        int64_t noteOffTick;
+        uint8_t noteOffPitch;
+    };
+
+    struct SeekPoint
+    {
+        MMLMidiEvent event; // Current event at this position
+        MMLTempoMap::Segment tempo;
+    };
+
+    struct TrackPoint
+    {
+        MMLInterpreter::Snapshot interpreter;
+        TrackCursor cursor;
+    };
+
+public:
+    /** Positions recorded through a stream, so that seek() only replays a short stretch. */
+    class SeekTable
+    {
+    public:
+        /** Gets the number of events the table covers (the whole stream if isComplete()). */
+        int64_t getNumEvents() const { return numEvents; }
+
+        /** Checks whether the table reaches the end of the stream. */
+        bool isComplete() const { return complete; }
+
+    private:
+        friend class MMLEventStream;
+
+        std::vector<SeekPoint> points;  // One every `interval` events, from the first
+        std::vector<TrackPoint> tracks; // numTracks entries per point
+        int numTracks = 0;
+        int64_t interval = 1;
+        int64_t numEvents = 0;
+        bool complete = true;
+    };
+
+    MMLEventStream();
+
+    /**
+     * Starts streaming a set of tracks from the beginning. Track N plays on MIDI channel N + 1.
+     * The programs must outlive the stream (or the next call) and must not be modified.
+     * @param programs Compiled tracks, in score order.
+     * @param numPrograms Number of tracks (at most MMLMidiEvent::numChannels).
+     * @param sampleRate Sample rate that sample positions are given in.
+     */
+    void setTracks(const MMLProgram* programs, int numPrograms, double sampleRate);
+
+    /** Same as above, for programs held through shared pointers (e.g. shared between scores). */
+    void setTracks(const std::shared_ptr<const MMLProgram>* programs, int numPrograms, double sampleRate);
+
+    /** Goes back to the first event. */
+    void rewind();
+
+    /** Checks whether every event has been consumed. */
+    bool isFinished() const { return finished; }
+
+    /** Gets the current event (only valid while not finished). */
+    const MMLMidiEvent& getEvent() const { return event; }
+
+    /** Gets the sample position of the current event. */
+    int64_t getSamplePosition() const { return samplePosition; }
+
+    /** Moves on to the next event. */
+    void advance();
+
+    /**
+     * Chooses whether tempo changes are returned as events of their own, for writers
+     * that need them, such as a MIDI file writer. They are skipped by default. A tempo
+     * change has status tempoChangeStatus; getTempo() gives the new tempo. Set this
+     * before buildSeekTable(), so that seeking counts the same events.
+     * @param shouldInclude True to return tempo changes.
+     */
+    void setIncludesTempoChanges(bool shouldInclude) { includesTempoChanges = shouldInclude; }
+
+    /** Checks whether the current event is a tempo change (see setIncludesTempoChanges()). */
+    bool isTempoChange() const { return event.data[0] == tempoChangeStatus; }
+
+    /** Gets the tempo in BPM at the current event. */
+    double getTempo() const { return tempo.tempo; }
+
+    /**
+     * Walks the whole stream once to record seek positions, then rewinds. Takes time in
+     * proportion to the expanded score, but memory only in proportion to the track count.
+     * Streams longer than maxIndexedEvents are only covered up to that point.
+     * @param table Receives the positions.
+     * @param cancelFlag Flag to poll to abandon the walk, or nullptr.
+     * @return False if the walk was cancelled.
+     */
+    bool buildSeekTable(SeekTable& table, const std::atomic<bool>* cancelFlag);
+
+    /**
+     * Moves to the first event at or after a sample position.
+     * Positions past the part covered by an incomplete table finish the stream.
+     * @param table Positions built by buildSeekTable() for the same tracks.
+     * @param position Target sample position.
+     */
+    void seek(const SeekTable& table, int64_t position);
+
+    /** Status byte of tempo change events (the MIDI file meta event marker; never sent as MIDI). */
+    static constexpr uint8_t tempoChangeStatus = 0xff;
+
+    /** Maximum number of positions in a SeekTable. */
+    static constexpr size_t maxSeekPoints = 1024;
+
+    /** Number of events buildSeekTable() walks at most (tens of hours of dense music). */
+    static constexpr int64_t maxIndexedEvents = int64_t(1) << 22;
+
+private:
+    bool fetch();
+    void pull(int track);
+    void savePoint(SeekTable& table) const;
+    void restorePoint(const SeekTable& table, size_t index);
+
+    std::optional<MMLInterpreter> interpreters[MMLMidiEvent::numChannels];
+    TrackCursor cursors[MMLMidiEvent::numChannels];
+    int numTracks;
+    double sampleRate;
+    MMLTempoMap::Segment tempo;
+    MMLMidiEvent event;
+    int64_t samplePosition;
+    bool finished;
+    bool includesTempoChanges;
+};
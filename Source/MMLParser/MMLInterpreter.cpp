@@ -0,0 +1,218 @@
+#include "MMLInterpreter.h"
+#include <algorithm>
+#include <cstdint>
+
+MMLInterpreter::State::State()
+    : octave(4),
+      defaultLength(MMLTime::lengthFromDenominator(4, false)),
+      tempo(120),
+      volume(100),
+      tupletScale(1) {}
+
+MMLInterpreter::MMLInterpreter(const MMLProgram& programToRun)
+    : program(programToRun), pc(0), endPosition(SIZE_MAX), repeatDepth(0) {}
+
+void MMLInterpreter::reset()
+{
+    restart(0, State());
+}
+
+void MMLInterpreter::restart(size_t position, const State& stateAtPosition)
+{
+    pc = position;
+    state = stateAtPosition;
+    repeatDepth = 0;
+}
+
+void MMLInterpreter::save(Snapshot& snapshot) const
+{
+    snapshot.pc = pc;
+    snapshot.state = state;
+    snapshot.repeatDepth = repeatDepth;
+    std::copy(repeatStack, repeatStack + repeatDepth, snapshot.repeatStack);
+}
+
+void MMLInterpreter::restore(const Snapshot& snapshot)
+{
+    pc = snapshot.pc;
+    state = snapshot.state;
+    repeatDepth = snapshot.repeatDepth;
+    std::copy(snapshot.repeatStack, snapshot.repeatStack + snapshot.repeatDepth, repeatStack);
+}
+
+bool MMLInterpreter::next(Event& event)
+{
+    const uint8_t* code = program.getData();
+    const size_t size = program.getSize();
+    const size_t end = std::min(size, endPosition);
+    uint32_t value = 0;
+
+    while (pc < end)
+    {
+        const uint8_t instruction = code[pc++];
+        const uint8_t flags = instruction & MMLProgram::flagsMask;
+
+        switch (static_cast<MMLProgram::Opcode>(instruction & MMLProgram::opcodeMask))
+        {
+            case MMLProgram::Opcode::Note:
+            {
+                const uint8_t pitch = code[pc++];
+                const bool isTied = (flags & MMLProgram::flagTied) != 0;
+
+                event.noteName = MMLProgram::noteNames[pitch & 0x07];
+                event.accidental = (pitch >> 3) - 1;
+                event.isTied = isTied;
+                emitTimedEvent(event, Event::Type::Note, readLength(pc, flags), !isTied);
+                return true;
+            }
+
+            case MMLProgram::Opcode::Rest:
+                event.noteName = 'r';
+                event.accidental = 0;
+                event.isTied = false;
+                emitTimedEvent(event, Event::Type::Rest, readLength(pc, flags), true);
+                return true;
+
+            case MMLProgram::Opcode::Octave:
+                if ((flags & MMLProgram::flagOctaveUp) != 0)
+                    state.octave = std::min(state.octave + 1, 8);
+                else if ((flags & MMLProgram::flagOctaveDown) != 0)
+                    state.octave = std::max(state.octave - 1, 0);
+                else
+                    state.octave = code[pc++];
+                break;
+
+            case MMLProgram::Opcode::Length:
+                state.defaultLength = readLength(pc, flags | MMLProgram::flagHasLength);
+                break;
+
+            case MMLProgram::Opcode::Tempo:
+                MMLProgram::readVarint(code, size, pc, value);
+                state.tempo = static_cast<int>(value);
+
+                event.type = Event::Type::Tempo;
+                event.tick = state.currentTime.floor();
+                event.lengthTicks = 0;
+                event.value = state.tempo;
+                return true;
+
+            case MMLProgram::Opcode::Volume:
+                state.volume = code[pc++];
+
+                event.type = Event::Type::Volume;
+                event.tick = state.currentTime.floor();
+                event.lengthTicks = 0;
+                event.value = state.volume;
+                return true;
+
+            case MMLProgram::Opcode::RepeatBegin:
+                MMLProgram::readVarint(code, size, pc, value);
+                repeatStack[repeatDepth++] = { pc, value };
+                break;
+
+            case MMLProgram::Opcode::RepeatEnd:
+            {
+                RepeatFrame& frame = repeatStack[repeatDepth - 1];
+
+                if (--frame.remaining > 0)
+                    pc = frame.bodyStart;
+                else
+                    repeatDepth--;
+                break;
+            }
+
+            case MMLProgram::Opcode::TupletBegin:
+            {
+                // The tuplet's length is shared between its notes in proportion to their own lengths
+                const MMLTime::Rational tupletLength = readLength(pc, flags);
+                const MMLTime::Rational bodyLength = measureTupletBody(pc);
+
+                state.tupletScale = bodyLength.isZero() ? MMLTime::Rational(1) : tupletLength / bodyLength;
+                break;
+            }
+
+            case MMLProgram::Opcode::TupletEnd:
+                state.tupletScale = MMLTime::Rational(1);
+                break;
+        }
+    }
+
+    return false;
+}
+
+MMLTime::Rational MMLInterpreter::readLength(size_t& position, uint8_t flags) const
+{
+    uint32_t denominator = 0;
+    if ((flags & MMLProgram::flagHasLength) != 0)
+        MMLProgram::readVarint(program.getData(), program.getSize(), position, denominator);
+
+    const bool isDotted = (flags & MMLProgram::flagDotted) != 0;
+
+    // A zero denominator keeps the default length
+    if (denominator > 0)
+        return MMLTime::lengthFromDenominator(static_cast<int>(denominator), isDotted);
+
+    return isDotted ? state.defaultLength * MMLTime::Rational(3, 2) : state.defaultLength;
+}
+
+MMLTime::Rational MMLInterpreter::measureTupletBody(size_t position) const
+{
+    const uint8_t* code = program.getData();
+    const size_t size = program.getSize();
+    MMLTime::Rational total;
+
+    // Tuplet bodies only hold Note, Rest and Octave instructions (checked by the compiler)
+    while (position < size)
+    {
+        const uint8_t instruction = code[position++];
+        const uint8_t flags = instruction & MMLProgram::flagsMask;
+
+        switch (static_cast<MMLProgram::Opcode>(instruction & MMLProgram::opcodeMask))
+        {
+            case MMLProgram::Opcode::Note:
+            {
+                position++; // Pitch
+                const MMLTime::Rational length = readLength(position, flags);
+
+                if ((flags & MMLProgram::flagTied) == 0)
+                    total += length;
+                break;
+            }
+
+            case MMLProgram::Opcode::Rest:
+                total += readLength(position, flags);
+                break;
+
+            case MMLProgram::Opcode::Octave:
+                if ((flags & (MMLProgram::flagOctaveUp | MMLProgram::flagOctaveDown)) == 0)
+                    position++;
+                break;
+
+            case MMLProgram::Opcode::TupletEnd:
+            case MMLProgram::Opcode::Length:
+            case MMLProgram::Opcode::Tempo:
+            case MMLProgram::Opcode::Volume:
+            case MMLProgram::Opcode::RepeatBegin:
+            case MMLProgram::Opcode::RepeatEnd:
+            case MMLProgram::Opcode::TupletBegin:
+                return total;
+        }
+    }
+
+    return total;
+}
+
+void MMLInterpreter::emitTimedEvent(Event& event, Event::Type type, const MMLTime::Rational& length, bool advancesTime)
+{
+    const MMLTime::Rational scaledLength = state.tupletScale == MMLTime::Rational(1) ? length : length * state.tupletScale;
+    const MMLTime::Rational endTime = state.currentTime + scaledLength;
+
+    event.type = type;
+    event.octave = state.octave;
+    event.tick = state.currentTime.floor();
+    event.lengthTicks = endTime.floor() - event.tick;
+    event.value = 0;
+
+    if (advancesTime)
+        state.currentTime = endTime;
+}
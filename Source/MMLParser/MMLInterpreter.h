@@ -0,0 +1,134 @@
+#pragma once
+
+#include "MMLProgram.h"
+#include "MMLTime.h"
+
+/**
+ * MMLInterpreter - Executes an MMLProgram and produces timed events
+ *
+ * The interpreter walks the bytecode with a fixed-size loop-counter stack, so it
+ * never allocates and its memory use does not depend on how often loops repeat.
+ * Events are pulled one at a time with next(). Time is tracked exactly in
+ * fractional ticks and reported as whole ticks.
+ */
+class MMLInterpreter
+{
+public:
+    struct State
+    {
+        State();
+        int octave;
+        MMLTime::Rational defaultLength; // In ticks
+        int tempo;
+        int volume;
+        MMLTime::Rational currentTime;   // In ticks
+        MMLTime::Rational tupletScale;   // Applied to note lengths inside a tuplet
+    };
+
+    struct Event
+    {
+        enum class Type : uint8_t { Note, Rest, Tempo, Volume };
+
+        Type type;
+        char noteName;
+        int accidental;
+        int octave;
+        bool isTied;
+        int64_t tick;        // Start position in ticks
+        int64_t lengthTicks; // Note or rest length in ticks
+        int value;           // Tempo or volume for Tempo / Volume events
+    };
+
+    struct RepeatFrame
+    {
+        size_t bodyStart;
+        uint32_t remaining;
+    };
+
+    /** Everything needed to carry on from the current point later, including inside loops. */
+    struct Snapshot
+    {
+        size_t pc;
+        State state;
+        RepeatFrame repeatStack[MMLProgram::maxRepeatDepth];
+        int repeatDepth;
+    };
+
+    /**
+     * Creates an interpreter positioned at the start of the program.
+     * The program must outlive the interpreter and must not be modified while in use.
+     */
+    explicit MMLInterpreter(const MMLProgram& program);
+
+    /** Rewinds to the start of the program with the default state. */
+    void reset();
+
+    /**
+     * Continues from an instruction boundary outside any loop or tuplet, with the
+     * state previously recorded there by getState().
+     * @param position Byte offset of the instruction in the program.
+     * @param stateAtPosition Musical state at that instruction.
+     */
+    void restart(size_t position, const State& stateAtPosition);
+
+    /**
+     * Makes next() stop at the given byte offset instead of the end of the program.
+     * The offset must be an instruction boundary outside any loop or tuplet.
+     */
+    void setEndPosition(size_t position) { endPosition = position; }
+
+    /** Gets the byte offset of the next instruction to execute. */
+    size_t getPosition() const { return pc; }
+
+    /**
+     * Executes instructions up to and including the next event.
+     * @param event Receives the event.
+     * @return False when the end of the program has been reached.
+     */
+    bool next(Event& event);
+
+    /** Gets the current musical state. */
+    const State& getState() const { return state; }
+
+    /**
+     * Records the execution point, so that an interpreter of the same program can
+     * later continue from it with restore().
+     * @param snapshot Receives the execution point.
+     */
+    void save(Snapshot& snapshot) const;
+
+    /**
+     * Continues from an execution point recorded with save() on the same program.
+     * @param snapshot The execution point.
+     */
+    void restore(const Snapshot& snapshot);
+
+    /**
+     * Converts a note to its MIDI note number (C4 = 60).
+     * @param noteName Note letter, 'a' to 'g'.
+     * @param accidental Semitones added by sharps and flats.
+     * @param octave Octave number.
+     * @return MIDI note number.
+     */
+    static constexpr int midiNoteNumber(char noteName, int accidental, int octave)
+    {
+        return noteSemitones[noteName - 'a'] + accidental + (octave + 1) * 12;
+    }
+
+private:
+    // Semitones above C of each note letter, from 'a' to 'g'
+    static constexpr int noteSemitones[7] = { 9, 11, 0, 2, 4, 5, 7 };
+
+    MMLTime::Rational readLength(size_t& position, uint8_t flags) const;
+    MMLTime::Rational measureTupletBody(size_t position) const;
+    void emitTimedEvent(Event& event, Event::Type type, const MMLTime::Rational& length, bool advancesTime);
+
+    const MMLProgram& program;
+    size_t pc;
+    size_t endPosition;
+    State state;
+    RepeatFrame repeatStack[MMLProgram::maxRepeatDepth];
+    int repeatDepth;
+};
+
+static_assert(MMLInterpreter::midiNoteNumber('c', 0, 4) == 60, "C4 is MIDI note 60");
@@ -0,0 +1,286 @@
+#include "MMLLexer.h"
+#include "MMLScanner.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace
+{
+    // What a source byte starts: a one-byte token, or something the scanner handles itself
+    enum class ByteClass : uint8_t
+    {
+        Token,
+        Whitespace,
+        Digit,
+        Slash,  // Possible comment
+        Ignored // Not part of the grammar (including UTF-8 lead and continuation bytes)
+    };
+
+    struct ByteRule
+    {
+        ByteClass byteClass;
+        MMLLexer::TokenType tokenType; // For ByteClass::Token
+    };
+
+    constexpr std::array<ByteRule, 256> makeByteRules()
+    {
+        using TokenType = MMLLexer::TokenType;
+
+        std::array<ByteRule, 256> rules {};
+
+        for (auto& rule : rules)
+            rule = { ByteClass::Ignored, TokenType::Note };
+
+        auto setToken = [&rules] (char c, TokenType type) { rules[static_cast<unsigned char>(c)] = { ByteClass::Token, type }; };
+
+        for (char c : { ' ', '\t', '\n', '\r', '\f', '\v' })
+            rules[static_cast<unsigned char>(c)].byteClass = ByteClass::Whitespace;
+
+        for (char c = '0'; c <= '9'; c++)
+            rules[static_cast<unsigned char>(c)].byteClass = ByteClass::Digit;
+
+        rules['/'].byteClass = ByteClass::Slash;
+
+        for (char c : { 'c', 'd', 'e', 'f', 'g', 'a', 'b' })
+            setToken(c, TokenType::Note);
+
+        setToken('r', TokenType::Rest);
+        setToken('o', TokenType::Octave);
+        setToken('>', TokenType::OctaveUp);
+        setToken('<', TokenType::OctaveDown);
+        setToken('l', TokenType::Length);
+        setToken('t', TokenType::Tempo);
+        setToken('v', TokenType::Volume);
+        setToken('[', TokenType::LoopBegin);
+        setToken(']', TokenType::LoopEnd);
+        setToken('{', TokenType::TupletBegin);
+        setToken('}', TokenType::TupletEnd);
+        setToken('+', TokenType::Sharp);
+        setToken('#', TokenType::Sharp);
+        setToken('-', TokenType::Flat);
+        setToken('.', TokenType::Dot);
+        setToken('&', TokenType::Tie);
+        setToken('^', TokenType::Tie);
+        setToken('*', TokenType::Star);
+
+        return rules;
+    }
+
+    // Built at compile time: classifying a byte is a single load
+    constexpr std::array<ByteRule, 256> byteRules = makeByteRules();
+
+    static_assert(byteRules['c'].byteClass == ByteClass::Token && byteRules['c'].tokenType == MMLLexer::TokenType::Note, "");
+    static_assert(byteRules[0x80].byteClass == ByteClass::Ignored, "");
+
+    bool isDigitByte(unsigned char c)
+    {
+        return byteRules[c].byteClass == ByteClass::Digit;
+    }
+
+    bool isWhitespaceByte(unsigned char c)
+    {
+        return byteRules[c].byteClass == ByteClass::Whitespace;
+    }
+
+    // Whitespace runs shorter than this are stepped through directly, which is cheaper than a vector search
+    constexpr size_t shortRunLength = 16;
+
+    size_t skipWhitespaceRun(const char* data, size_t pos, size_t size)
+    {
+        const size_t shortRunEnd = std::min(size, pos + shortRunLength);
+
+        while (pos < shortRunEnd && isWhitespaceByte(static_cast<unsigned char>(data[pos])))
+            pos++;
+
+        return pos == shortRunEnd ? MMLScanner::skipWhitespace(data, pos, size) : pos;
+    }
+
+    // Skips a comment starting at pos, returning where it ends (or pos if there is none there)
+    size_t skipComment(const char* data, size_t pos, size_t size)
+    {
+        if (pos + 1 < size && data[pos] == '/')
+        {
+            // "// ..." runs to end of line, "/* ... */" to the closing marker
+            if (data[pos + 1] == '/')
+                return MMLScanner::findEither(data, pos + 2, size, '\n', '\n');
+
+            if (data[pos + 1] == '*')
+            {
+                const size_t end = MMLScanner::findBlockCommentEnd(data, pos + 2, size);
+                return end < size ? end + 2 : size;
+            }
+        }
+
+        return pos;
+    }
+}
+
+void MMLLexer::tokenize(std::string_view source, std::vector<Token>& tokens)
+{
+    tokens.clear();
+
+    // Most bytes of a score are commands, so this avoids regrowing in the common case
+    tokens.reserve(source.size() / 2 + 1);
+
+    tokenizeRange(source, 0, source.size(), tokens);
+}
+
+size_t MMLLexer::tokenizeRange(std::string_view source, size_t begin, size_t stopOffset, std::vector<Token>& tokens)
+{
+    const char* const data = source.data();
+    const size_t size = source.size();
+    size_t pos = begin;
+
+    auto addToken = [&tokens] (TokenType type, char symbol, size_t offset, size_t length, int value)
+    {
+        tokens.push_back({ type, symbol, static_cast<uint32_t>(offset), static_cast<uint32_t>(length), value });
+    };
+
+    while (pos < size)
+    {
+        const unsigned char c = static_cast<unsigned char>(data[pos]);
+        const ByteRule rule = byteRules[c];
+
+        if (rule.byteClass == ByteClass::Whitespace)
+        {
+            pos = skipWhitespaceRun(data, pos + 1, size);
+            continue;
+        }
+
+        // Nothing carries over between tokens, so lexing can resume from here later
+        if (pos >= stopOffset)
+            return pos;
+
+        switch (rule.byteClass)
+        {
+            case ByteClass::Token:
+                addToken(rule.tokenType, static_cast<char>(c), pos, 1, 0);
+                break;
+
+            case ByteClass::Digit:
+            {
+                const size_t start = pos;
+                int value = 0;
+
+                while (pos < size && isDigitByte(static_cast<unsigned char>(data[pos])))
+                {
+                    if (value > (maxNumberValue - 9) / 10)
+                    {
+                        // Saturated: the rest of the run cannot change the value
+                        value = maxNumberValue;
+                        pos = MMLScanner::skipDigits(data, pos, size);
+                        break;
+                    }
+
+                    value = value * 10 + (data[pos] - '0');
+                    pos++;
+                }
+
+                addToken(TokenType::Number, static_cast<char>(c), start, pos - start, value);
+                continue;
+            }
+
+            case ByteClass::Slash:
+            {
+                const size_t end = skipComment(data, pos, size);
+
+                if (end != pos)
+                {
+                    pos = end;
+                    continue;
+                }
+                break;
+            }
+
+            case ByteClass::Whitespace:
+            case ByteClass::Ignored:
+                // Unknown byte (including UTF-8 continuation bytes) - ignored
+                break;
+        }
+
+        pos++;
+    }
+
+    return size;
+}
+
+void MMLLexer::splitTracks(std::string_view source, std::vector<TrackRange>& tracks)
+{
+    tracks.clear();
+
+    const char* const data = source.data();
+    const size_t size = source.size();
+    size_t trackStart = 0;
+    size_t pos = 0;
+
+    auto addTrack = [&tracks, &trackStart] (size_t end)
+    {
+        tracks.push_back({ static_cast<uint32_t>(trackStart), static_cast<uint32_t>(end - trackStart) });
+    };
+
+    while (true)
+    {
+        pos = MMLScanner::findEither(data, pos, size, ';', '/');
+
+        if (pos >= size)
+            break;
+
+        if (data[pos] == ';')
+        {
+            addTrack(pos);
+            trackStart = pos + 1;
+            pos++;
+            continue;
+        }
+
+        // Comments are skipped exactly as tokenizeRange() does, so a ';' inside one is ignored
+        const size_t end = skipComment(data, pos, size);
+        pos = (end != pos) ? end : pos + 1;
+    }
+
+    addTrack(size);
+}
+
+void MMLLexer::normalizeWhitespace(std::string_view source, std::string& normalized)
+{
+    const char* const data = source.data();
+    const size_t size = source.size();
+
+    // The canonical form is never longer than the source, so it is written in place
+    normalized.resize(size);
+    char* const output = &normalized[0];
+    size_t length = 0;
+    size_t pos = MMLScanner::skipWhitespace(data, 0, size);
+
+    while (pos < size)
+    {
+        while (pos < size && !isWhitespaceByte(static_cast<unsigned char>(data[pos])))
+            output[length++] = data[pos++];
+
+        if (pos == size)
+            break;
+
+        // Whitespace only separates tokens, so how much of it there is never matters
+        const size_t shortRunEnd = std::min(size, pos + shortRunLength);
+        char separator = ' ';
+
+        for (; pos < shortRunEnd && isWhitespaceByte(static_cast<unsigned char>(data[pos])); pos++)
+            if (data[pos] == '\n')
+                separator = '\n';
+
+        if (pos == shortRunEnd)
+        {
+            const size_t nextToken = MMLScanner::skipWhitespace(data, pos, size);
+
+            if (std::memchr(data + pos, '\n', nextToken - pos) != nullptr)
+                separator = '\n';
+
+            pos = nextToken;
+        }
+
+        if (pos < size)
+            output[length++] = separator;
+    }
+
+    normalized.resize(length);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * MMLLexer - Single-pass tokenizer for MML source text
+ *
+ * Scans a contiguous UTF-8 byte buffer exactly once and produces a flat token
+ * stream. Each token records its byte offset in the source, so the parser never
+ * has to index back into the original string.
+ *
+ * Whitespace, comments (block and line) and any byte that is not part of the
+ * MML grammar (including multi-byte UTF-8 sequences) produce no tokens.
+ * Track separators (';') are handled by splitTracks() before tokenizing.
+ * Runs of whitespace, digits and comment text are skipped with MMLScanner,
+ * many bytes at a time.
+ */
+class MMLLexer
+{
+public:
+    enum class TokenType : uint8_t
+    {
+        Note,        // c d e f g a b
+        Rest,        // r
+        Octave,      // o
+        OctaveUp,    // >
+        OctaveDown,  // <
+        Length,      // l
+        Tempo,       // t
+        Volume,      // v
+        LoopBegin,   // [
+        LoopEnd,     // ]
+        TupletBegin, // {
+        TupletEnd,   // }
+        Number,      // Run of decimal digits
+        Sharp,       // + or #
+        Flat,        // -
+        Dot,         // .
+        Tie,         // & or ^
+        Star         // *
+    };
+
+    /** Number of TokenType values, for tables indexed by token type. */
+    static constexpr int numTokenTypes = static_cast<int>(TokenType::Star) + 1;
+
+    struct Token
+    {
+        TokenType type;
+        char symbol;     // Source character (first digit for numbers)
+        uint32_t offset; // Byte offset in the source
+        uint32_t length; // Length in bytes
+        int value;       // Parsed value for Number tokens (saturated at maxNumberValue)
+
+        /** Returns the byte offset just past this token. */
+        uint32_t end() const { return offset + length; }
+    };
+
+    /** Byte range of one track of a score. */
+    struct TrackRange
+    {
+        uint32_t offset; // Byte offset in the source
+        uint32_t length; // Length in bytes, excluding the separator
+    };
+
+    /** Largest value a Number token can hold; longer digit runs saturate. */
+    static constexpr int maxNumberValue = 99999999;
+
+    /**
+     * Tokenizes the given source.
+     * @param source UTF-8 encoded MML text.
+     * @param tokens Receives the token stream (cleared first).
+     */
+    static void tokenize(std::string_view source, std::vector<Token>& tokens);
+
+    /**
+     * Tokenizes part of the given source, starting at a position where no token or
+     * comment is open (the start of the source or of a token).
+     * @param source UTF-8 encoded MML text.
+     * @param begin Byte offset to start at.
+     * @param stopOffset Lexing stops at the first non-whitespace byte at or after this offset.
+     * @param tokens Receives the tokens (appended).
+     * @return Offset where lexing stopped, or the source size if it reached the end.
+     */
+    static size_t tokenizeRange(std::string_view source, size_t begin, size_t stopOffset, std::vector<Token>& tokens);
+
+    /**
+     * Splits a score into tracks at each ';' that is not inside a comment.
+     * @param source UTF-8 encoded MML text.
+     * @param tracks Receives the track ranges (cleared first); there is always at least one.
+     */
+    static void splitTracks(std::string_view source, std::vector<TrackRange>& tracks);
+
+    /**
+     * Produces a canonical form of the source for comparing scores: leading and trailing
+     * whitespace is dropped and every other run of whitespace becomes a single space, or
+     * a single newline if it contains one (newlines end line comments). Sources with the
+     * same canonical form compile to the same result.
+     * @param source UTF-8 encoded MML text.
+     * @param normalized Receives the canonical form (replaced; its capacity is reused).
+     */
+    static void normalizeWhitespace(std::string_view source, std::string& normalized);
+};
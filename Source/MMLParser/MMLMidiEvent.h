@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * MMLMidiEvent - Fixed-size MIDI event on the tick timeline
+ *
+ * Plain data, so event lists are flat arrays that can be copied with memcpy
+ * and scanned without touching the heap.
+ */
+struct MMLMidiEvent
+{
+    /** Number of MIDI channels, and so the most tracks a score can hold. */
+    static constexpr int numChannels = 16;
+
+    /** Velocity of every note-on (volume commands do not change it). */
+    static constexpr uint8_t noteOnVelocity = 100;
+
+    int64_t tick;    // Position in ticks (MMLTime::ticksPerQuarterNote per quarter note)
+    uint8_t data[3]; // Status byte, then the two data bytes
+
+    uint8_t getStatus() const { return data[0]; }
+    bool isNoteOn() const { return (data[0] & 0xf0) == 0x90 && data[2] != 0; }
+    bool isNoteOff() const { return (data[0] & 0xf0) == 0x80 || ((data[0] & 0xf0) == 0x90 && data[2] == 0); }
+    int getChannel() const { return (data[0] & 0x0f) + 1; }
+    int getNoteNumber() const { return data[1]; }
+};
+
+static_assert(std::is_trivially_copyable<MMLMidiEvent>::value, "MMLMidiEvent must stay plain data");
+static_assert(sizeof(MMLMidiEvent) == 16, "MMLMidiEvent should pack four events per cache line");
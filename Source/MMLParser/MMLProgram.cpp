@@ -0,0 +1,327 @@
+#include "MMLProgram.h"
+#include <algorithm>
+
+constexpr char MMLProgram::noteNames[7];
+
+void MMLProgram::clear()
+{
+    code.clear();
+}
+
+void MMLProgram::truncate(size_t size)
+{
+    code.resize(std::min(size, code.size()));
+}
+
+void MMLProgram::append(const uint8_t* data, size_t size)
+{
+    code.insert(code.end(), data, data + size);
+}
+
+void MMLProgram::addNote(char noteName, int accidental, int lengthDenominator, bool isDotted, bool isTied)
+{
+    int noteIndex = 0;
+    while (noteIndex < 6 && noteNames[noteIndex] != noteName)
+        noteIndex++;
+
+    uint8_t flags = 0;
+    if (isDotted)
+        flags |= flagDotted;
+    if (isTied)
+        flags |= flagTied;
+    if (lengthDenominator > 0)
+        flags |= flagHasLength;
+
+    addOpcode(Opcode::Note, flags);
+    code.push_back(static_cast<uint8_t>(noteIndex | ((accidental + 1) << 3)));
+
+    if (lengthDenominator > 0)
+        addVarint(static_cast<uint32_t>(lengthDenominator));
+}
+
+void MMLProgram::addRest(int lengthDenominator, bool isDotted)
+{
+    uint8_t flags = 0;
+    if (isDotted)
+        flags |= flagDotted;
+    if (lengthDenominator > 0)
+        flags |= flagHasLength;
+
+    addOpcode(Opcode::Rest, flags);
+
+    if (lengthDenominator > 0)
+        addVarint(static_cast<uint32_t>(lengthDenominator));
+}
+
+void MMLProgram::addOctave(int octave)
+{
+    addOpcode(Opcode::Octave, 0);
+    code.push_back(static_cast<uint8_t>(octave));
+}
+
+void MMLProgram::addOctaveUp()
+{
+    addOpcode(Opcode::Octave, flagOctaveUp);
+}
+
+void MMLProgram::addOctaveDown()
+{
+    addOpcode(Opcode::Octave, flagOctaveDown);
+}
+
+void MMLProgram::addLength(int lengthDenominator, bool isDotted)
+{
+    addOpcode(Opcode::Length, isDotted ? flagDotted : 0);
+    addVarint(static_cast<uint32_t>(lengthDenominator));
+}
+
+void MMLProgram::addTempo(int tempo)
+{
+    addOpcode(Opcode::Tempo, 0);
+    addVarint(static_cast<uint32_t>(tempo));
+}
+
+void MMLProgram::addVolume(int volume)
+{
+    addOpcode(Opcode::Volume, 0);
+    code.push_back(static_cast<uint8_t>(volume));
+}
+
+void MMLProgram::beginRepeat(int count)
+{
+    addOpcode(Opcode::RepeatBegin, 0);
+    addVarint(static_cast<uint32_t>(count));
+}
+
+void MMLProgram::endRepeat()
+{
+    addOpcode(Opcode::RepeatEnd, 0);
+}
+
+void MMLProgram::beginTuplet(int lengthDenominator, bool isDotted)
+{
+    uint8_t flags = 0;
+    if (isDotted)
+        flags |= flagDotted;
+    if (lengthDenominator > 0)
+        flags |= flagHasLength;
+
+    addOpcode(Opcode::TupletBegin, flags);
+
+    if (lengthDenominator > 0)
+        addVarint(static_cast<uint32_t>(lengthDenominator));
+}
+
+void MMLProgram::endTuplet()
+{
+    addOpcode(Opcode::TupletEnd, 0);
+}
+
+uint64_t MMLProgram::countTimedEvents() const
+{
+    const uint8_t* bytes = code.data();
+    const size_t size = code.size();
+    size_t pos = 0;
+    uint32_t value = 0;
+
+    // repeatMultiplier[d] is how often an instruction at loop depth d runs
+    uint64_t repeatMultiplier[maxRepeatDepth + 1] = { 1 };
+    int depth = 0;
+    uint64_t total = 0;
+
+    auto multiply = [] (uint64_t a, uint64_t b) { return b != 0 && a > UINT64_MAX / b ? UINT64_MAX : a * b; };
+
+    while (pos < size)
+    {
+        const uint8_t opcode = bytes[pos] & opcodeMask;
+        const uint8_t flags = bytes[pos] & flagsMask;
+        pos++;
+
+        switch (static_cast<Opcode>(opcode))
+        {
+            case Opcode::Note:
+                pos++; // Pitch; the remaining operands are the same as a rest's
+                [[fallthrough]];
+
+            case Opcode::Rest:
+                if ((flags & flagHasLength) != 0)
+                    readVarint(bytes, size, pos, value);
+                total = repeatMultiplier[depth] > UINT64_MAX - total ? UINT64_MAX : total + repeatMultiplier[depth];
+                break;
+
+            case Opcode::Octave:
+                if ((flags & (flagOctaveUp | flagOctaveDown)) == 0)
+                    pos++;
+                break;
+
+            case Opcode::Volume:
+                pos++;
+                break;
+
+            case Opcode::Length:
+            case Opcode::Tempo:
+                readVarint(bytes, size, pos, value);
+                break;
+
+            case Opcode::RepeatBegin:
+                readVarint(bytes, size, pos, value);
+                repeatMultiplier[depth + 1] = multiply(repeatMultiplier[depth], value);
+                depth++;
+                break;
+
+            case Opcode::RepeatEnd:
+                depth--;
+                break;
+
+            case Opcode::TupletBegin:
+                if ((flags & flagHasLength) != 0)
+                    readVarint(bytes, size, pos, value);
+                break;
+
+            case Opcode::TupletEnd:
+                break;
+        }
+    }
+
+    return total;
+}
+
+bool MMLProgram::loadFrom(const void* data, size_t size)
+{
+    clear();
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    size_t pos = 0;
+    int depth = 0;
+    bool inTuplet = false;
+    bool tupletHasNotes = false;
+
+    // Walk every instruction once to make sure the interpreter can trust the stream
+    while (pos < size)
+    {
+        const uint8_t opcode = bytes[pos] & opcodeMask;
+        const uint8_t flags = bytes[pos] & flagsMask;
+        pos++;
+
+        uint32_t value = 0;
+        bool valid = true;
+
+        // Tuplet bodies are measured by scanning ahead, so they may only hold timed notes
+        if (inTuplet)
+        {
+            const auto type = static_cast<Opcode>(opcode);
+            if (type != Opcode::Note && type != Opcode::Rest && type != Opcode::Octave && type != Opcode::TupletEnd)
+                return false;
+
+            tupletHasNotes |= (type == Opcode::Note || type == Opcode::Rest);
+        }
+
+        switch (static_cast<Opcode>(opcode))
+        {
+            case Opcode::Note:
+                valid = pos < size && (bytes[pos] & 0x07) < 7 && (bytes[pos] >> 3) <= 2;
+                pos++;
+                if (valid && (flags & flagHasLength) != 0)
+                    valid = readLengthOperand(bytes, size, pos, false);
+                break;
+
+            case Opcode::Rest:
+                if ((flags & flagHasLength) != 0)
+                    valid = readLengthOperand(bytes, size, pos, false);
+                break;
+
+            case Opcode::Octave:
+                if ((flags & (flagOctaveUp | flagOctaveDown)) == 0)
+                    valid = pos < size && bytes[pos++] <= 8;
+                break;
+
+            case Opcode::Length:
+                valid = readLengthOperand(bytes, size, pos, true);
+                break;
+
+            case Opcode::Tempo:
+                valid = readVarint(bytes, size, pos, value) && value >= 20 && value <= 300;
+                break;
+
+            case Opcode::Volume:
+                valid = pos < size && bytes[pos++] <= 127;
+                break;
+
+            case Opcode::RepeatBegin:
+                valid = readVarint(bytes, size, pos, value) && value >= 1 && ++depth <= maxRepeatDepth;
+                break;
+
+            case Opcode::RepeatEnd:
+                valid = --depth >= 0;
+                break;
+
+            case Opcode::TupletBegin:
+                if ((flags & flagHasLength) != 0)
+                    valid = readLengthOperand(bytes, size, pos, false);
+                inTuplet = true;
+                tupletHasNotes = false;
+                break;
+
+            case Opcode::TupletEnd:
+                valid = inTuplet && tupletHasNotes;
+                inTuplet = false;
+                break;
+
+            default:
+                valid = false;
+                break;
+        }
+
+        if (!valid)
+            return false;
+    }
+
+    if (depth != 0 || inTuplet)
+        return false;
+
+    code.assign(bytes, bytes + size);
+    return true;
+}
+
+bool MMLProgram::readVarint(const uint8_t* data, size_t size, size_t& pos, uint32_t& value)
+{
+    value = 0;
+
+    for (int shift = 0; shift < 32; shift += 7)
+    {
+        if (pos >= size)
+            return false;
+
+        const uint8_t byte = data[pos++];
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool MMLProgram::readLengthOperand(const uint8_t* data, size_t size, size_t& pos, bool allowZero)
+{
+    uint32_t value = 0;
+    return readVarint(data, size, pos, value)
+        && (allowZero || value > 0)
+        && value <= static_cast<uint32_t>(MMLTime::maxLengthDenominator);
+}
+
+void MMLProgram::addOpcode(Opcode opcode, uint8_t flags)
+{
+    code.push_back(static_cast<uint8_t>(static_cast<uint8_t>(opcode) | flags));
+}
+
+void MMLProgram::addVarint(uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        code.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+
+    code.push_back(static_cast<uint8_t>(value));
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "MMLTime.h"
+
+/**
+ * MMLProgram - Compact bytecode form of a compiled MML score
+ *
+ * Each instruction starts with one byte holding the opcode in the low nibble and
+ * flags in the high nibble, followed by packed operands (single bytes or LEB128
+ * varints). Loops are kept as RepeatBegin/RepeatEnd pairs rather than unrolled,
+ * so a program is typically a small fraction of the size of its expanded notes.
+ *
+ * Programs are plain byte buffers: they can be cached, serialized with getData()
+ * and restored with loadFrom(), which validates the stream before accepting it.
+ */
+class MMLProgram
+{
+public:
+    enum class Opcode : uint8_t
+    {
+        Note,        // [pitch] [length?]  pitch = note index (0-6) | (accidental + 1) << 3
+        Rest,        // [length?]
+        Octave,      // [octave] (absolute) or no operand with flagOctaveUp / flagOctaveDown
+        Length,      // [length]
+        Tempo,       // [bpm]
+        Volume,      // [volume]
+        RepeatBegin, // [count]
+        RepeatEnd,
+        TupletBegin, // [length?]  body holds only Note, Rest and Octave instructions
+        TupletEnd
+    };
+
+    static constexpr uint8_t opcodeMask = 0x0f;
+    static constexpr uint8_t flagsMask = 0xf0;
+    static constexpr uint8_t flagDotted = 0x10;     // Note, Rest, Length, TupletBegin
+    static constexpr uint8_t flagTied = 0x20;       // Note
+    static constexpr uint8_t flagHasLength = 0x40;  // Note, Rest, TupletBegin
+    static constexpr uint8_t flagOctaveUp = 0x10;   // Octave
+    static constexpr uint8_t flagOctaveDown = 0x20; // Octave
+
+    /** Maximum nesting depth of RepeatBegin/RepeatEnd pairs. */
+    static constexpr int maxRepeatDepth = 32;
+
+    /** Removes all instructions, keeping the allocated capacity. */
+    void clear();
+
+    /** Removes the instructions from the given byte offset onwards. */
+    void truncate(size_t size);
+
+    /**
+     * Appends already-compiled instructions, such as a section kept from a previous compile.
+     * Bytecode holds no absolute offsets, so a section stays valid at any position.
+     */
+    void append(const uint8_t* data, size_t size);
+
+    void addNote(char noteName, int accidental, int lengthDenominator, bool isDotted, bool isTied);
+    void addRest(int lengthDenominator, bool isDotted);
+    void addOctave(int octave);
+    void addOctaveUp();
+    void addOctaveDown();
+    void addLength(int lengthDenominator, bool isDotted);
+    void addTempo(int tempo);
+    void addVolume(int volume);
+    void beginRepeat(int count);
+    void endRepeat();
+    void beginTuplet(int lengthDenominator, bool isDotted);
+    void endTuplet();
+
+    /** Gets the raw bytecode. */
+    const uint8_t* getData() const { return code.data(); }
+
+    /** Gets the bytecode size in bytes. */
+    size_t getSize() const { return code.size(); }
+
+    /**
+     * Counts the notes and rests the program produces when it runs, with every loop
+     * repeated in full, in one pass over the bytecode (nothing is expanded).
+     * @return Number of Note and Rest instructions executed, saturating at UINT64_MAX.
+     */
+    uint64_t countTimedEvents() const;
+
+    /**
+     * Replaces this program with serialized bytecode.
+     * @param data Bytecode previously obtained from getData().
+     * @param size Size of the bytecode in bytes.
+     * @return True if the bytecode is well-formed, false otherwise (program is left empty).
+     */
+    bool loadFrom(const void* data, size_t size);
+
+    /** Note letter for each pitch index stored in a Note instruction. */
+    static constexpr char noteNames[7] = { 'c', 'd', 'e', 'f', 'g', 'a', 'b' };
+
+    /**
+     * Reads a LEB128 varint.
+     * @param data Bytecode buffer.
+     * @param size Buffer size.
+     * @param pos Read position, advanced past the varint.
+     * @param value Receives the decoded value.
+     * @return False if the varint is truncated or too long.
+     */
+    static bool readVarint(const uint8_t* data, size_t size, size_t& pos, uint32_t& value);
+
+private:
+    static bool readLengthOperand(const uint8_t* data, size_t size, size_t& pos, bool allowZero);
+    void addOpcode(Opcode opcode, uint8_t flags);
+    void addVarint(uint32_t value);
+
+    std::vector<uint8_t> code;
+};
@@ -0,0 +1,365 @@
+#include "MMLScanner.h"
+#include <atomic>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+ #define MML_SCANNER_X64 1
+ #include <immintrin.h>
+ #if defined(_MSC_VER)
+  #include <intrin.h>
+  #define MML_SCANNER_AVX2_FUNCTION
+ #else
+  #define MML_SCANNER_AVX2_FUNCTION __attribute__((target("avx2")))
+ #endif
+#else
+ #define MML_SCANNER_X64 0
+#endif
+
+namespace
+{
+    struct ScanFunctions
+    {
+        size_t (*skipWhitespace)(const char* data, size_t pos, size_t size);
+        size_t (*skipDigits)(const char* data, size_t pos, size_t size);
+        size_t (*findEither)(const char* data, size_t pos, size_t size, char first, char second);
+        size_t (*findBlockCommentEnd)(const char* data, size_t pos, size_t size);
+    };
+
+    //==============================================================================
+    // Plain loops, used on other processors and for the bytes after the last full vector
+
+    bool isWhitespaceByte(unsigned char c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    size_t scalarSkipWhitespace(const char* data, size_t pos, size_t size)
+    {
+        while (pos < size && isWhitespaceByte(static_cast<unsigned char>(data[pos])))
+            pos++;
+
+        return pos;
+    }
+
+    size_t scalarSkipDigits(const char* data, size_t pos, size_t size)
+    {
+        while (pos < size && static_cast<unsigned char>(data[pos] - '0') <= 9)
+            pos++;
+
+        return pos;
+    }
+
+    size_t scalarFindEither(const char* data, size_t pos, size_t size, char first, char second)
+    {
+        while (pos < size && data[pos] != first && data[pos] != second)
+            pos++;
+
+        return pos;
+    }
+
+    size_t scalarFindBlockCommentEnd(const char* data, size_t pos, size_t size)
+    {
+        for (; pos + 1 < size; pos++)
+            if (data[pos] == '*' && data[pos + 1] == '/')
+                return pos;
+
+        return size;
+    }
+
+    constexpr ScanFunctions scalarFunctions { scalarSkipWhitespace, scalarSkipDigits, scalarFindEither, scalarFindBlockCommentEnd };
+
+   #if MML_SCANNER_X64
+    int lowestSetBit(uint32_t mask)
+    {
+       #if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+       #else
+        return __builtin_ctz(mask);
+       #endif
+    }
+
+    //==============================================================================
+    // SSE2 is part of x86-64, so these need no check. Each sets a mask bit for every
+    // byte that ends the run, and the lowest set bit gives its position.
+
+    __m128i sse2Load(const char* data)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    }
+
+    // Unsigned range test: bytes in [first, last] become 0xff
+    __m128i sse2InRange(__m128i bytes, char first, char last)
+    {
+        const __m128i offsets = _mm_sub_epi8(bytes, _mm_set1_epi8(first));
+        return _mm_cmpeq_epi8(_mm_min_epu8(offsets, _mm_set1_epi8(static_cast<char>(last - first))), offsets);
+    }
+
+    size_t sse2SkipWhitespace(const char* data, size_t pos, size_t size)
+    {
+        for (; pos + 16 <= size; pos += 16)
+        {
+            const __m128i bytes = sse2Load(data + pos);
+            const __m128i whitespace = _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), sse2InRange(bytes, '\t', '\r'));
+            const auto others = static_cast<uint32_t>(~_mm_movemask_epi8(whitespace)) & 0xffffu;
+
+            if (others != 0)
+                return pos + static_cast<size_t>(lowestSetBit(others));
+        }
+
+        return scalarSkipWhitespace(data, pos, size);
+    }
+
+    size_t sse2SkipDigits(const char* data, size_t pos, size_t size)
+    {
+        for (; pos + 16 <= size; pos += 16)
+        {
+            const auto others = static_cast<uint32_t>(~_mm_movemask_epi8(sse2InRange(sse2Load(data + pos), '0', '9'))) & 0xffffu;
+
+            if (others != 0)
+                return pos + static_cast<size_t>(lowestSetBit(others));
+        }
+
+        return scalarSkipDigits(data, pos, size);
+    }
+
+    size_t sse2FindEither(const char* data, size_t pos, size_t size, char first, char second)
+    {
+        const __m128i firstBytes = _mm_set1_epi8(first);
+        const __m128i secondBytes = _mm_set1_epi8(second);
+
+        for (; pos + 16 <= size; pos += 16)
+        {
+            const __m128i bytes = sse2Load(data + pos);
+            const auto matches = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, firstBytes),
+                                                                                      _mm_cmpeq_epi8(bytes, secondBytes))));
+
+            if (matches != 0)
+                return pos + static_cast<size_t>(lowestSetBit(matches));
+        }
+
+        return scalarFindEither(data, pos, size, first, second);
+    }
+
+    size_t sse2FindBlockCommentEnd(const char* data, size_t pos, size_t size)
+    {
+        // Compares each byte and the one after it in the same step
+        for (; pos + 17 <= size; pos += 16)
+        {
+            const __m128i stars = _mm_cmpeq_epi8(sse2Load(data + pos), _mm_set1_epi8('*'));
+            const __m128i slashes = _mm_cmpeq_epi8(sse2Load(data + pos + 1), _mm_set1_epi8('/'));
+            const auto matches = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(stars, slashes)));
+
+            if (matches != 0)
+                return pos + static_cast<size_t>(lowestSetBit(matches));
+        }
+
+        return scalarFindBlockCommentEnd(data, pos, size);
+    }
+
+    constexpr ScanFunctions sse2Functions { sse2SkipWhitespace, sse2SkipDigits, sse2FindEither, sse2FindBlockCommentEnd };
+
+    //==============================================================================
+    // The same searches 32 bytes at a time, only called once the processor is known to support AVX2
+
+    MML_SCANNER_AVX2_FUNCTION __m256i avx2Load(const char* data)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+    }
+
+    MML_SCANNER_AVX2_FUNCTION __m256i avx2InRange(__m256i bytes, char first, char last)
+    {
+        const __m256i offsets = _mm256_sub_epi8(bytes, _mm256_set1_epi8(first));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(offsets, _mm256_set1_epi8(static_cast<char>(last - first))), offsets);
+    }
+
+    MML_SCANNER_AVX2_FUNCTION size_t avx2SkipWhitespace(const char* data, size_t pos, size_t size)
+    {
+        for (; pos + 32 <= size; pos += 32)
+        {
+            const __m256i bytes = avx2Load(data + pos);
+            const __m256i whitespace = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')), avx2InRange(bytes, '\t', '\r'));
+            const auto others = ~static_cast<uint32_t>(_mm256_movemask_epi8(whitespace));
+
+            if (others != 0)
+                return pos + static_cast<size_t>(lowestSetBit(others));
+        }
+
+        return sse2SkipWhitespace(data, pos, size);
+    }
+
+    MML_SCANNER_AVX2_FUNCTION size_t avx2SkipDigits(const char* data, size_t pos, size_t size)
+    {
+        for (; pos + 32 <= size; pos += 32)
+        {
+            const auto others = ~static_cast<uint32_t>(_mm256_movemask_epi8(avx2InRange(avx2Load(data + pos), '0', '9')));
+
+            if (others != 0)
+                return pos + static_cast<size_t>(lowestSetBit(others));
+        }
+
+        return sse2SkipDigits(data, pos, size);
+    }
+
+    MML_SCANNER_AVX2_FUNCTION size_t avx2FindEither(const char* data, size_t pos, size_t size, char first, char second)
+    {
+        const __m256i firstBytes = _mm256_set1_epi8(first);
+        const __m256i secondBytes = _mm256_set1_epi8(second);
+
+        for (; pos + 32 <= size; pos += 32)
+        {
+            const __m256i bytes = avx2Load(data + pos);
+            const auto matches = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, firstBytes),
+                                                                                            _mm256_cmpeq_epi8(bytes, secondBytes))));
+
+            if (matches != 0)
+                return pos + static_cast<size_t>(lowestSetBit(matches));
+        }
+
+        return sse2FindEither(data, pos, size, first, second);
+    }
+
+    MML_SCANNER_AVX2_FUNCTION size_t avx2FindBlockCommentEnd(const char* data, size_t pos, size_t size)
+    {
+        for (; pos + 33 <= size; pos += 32)
+        {
+            const __m256i stars = _mm256_cmpeq_epi8(avx2Load(data + pos), _mm256_set1_epi8('*'));
+            const __m256i slashes = _mm256_cmpeq_epi8(avx2Load(data + pos + 1), _mm256_set1_epi8('/'));
+            const auto matches = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(stars, slashes)));
+
+            if (matches != 0)
+                return pos + static_cast<size_t>(lowestSetBit(matches));
+        }
+
+        return sse2FindBlockCommentEnd(data, pos, size);
+    }
+
+    constexpr ScanFunctions avx2Functions { avx2SkipWhitespace, avx2SkipDigits, avx2FindEither, avx2FindBlockCommentEnd };
+
+    bool processorHasAVX2()
+    {
+       #if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+
+        if (info[0] < 7)
+            return false;
+
+        // The operating system must also save the upper halves of the registers
+        __cpuid(info, 1);
+        const bool osSupportsAVX = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+
+        __cpuidex(info, 7, 0);
+        return osSupportsAVX && (info[1] & (1 << 5)) != 0;
+       #else
+        return __builtin_cpu_supports("avx2");
+       #endif
+    }
+   #endif
+
+    const ScanFunctions& functionsFor(MMLScanner::InstructionSet instructionSet)
+    {
+       #if MML_SCANNER_X64
+        if (instructionSet == MMLScanner::InstructionSet::AVX2)
+            return avx2Functions;
+
+        if (instructionSet == MMLScanner::InstructionSet::SSE2)
+            return sse2Functions;
+       #else
+        (void) instructionSet;
+       #endif
+
+        return scalarFunctions;
+    }
+
+    const ScanFunctions& selectBestFunctions();
+
+    size_t firstUseSkipWhitespace(const char* data, size_t pos, size_t size)
+    {
+        return selectBestFunctions().skipWhitespace(data, pos, size);
+    }
+
+    size_t firstUseSkipDigits(const char* data, size_t pos, size_t size)
+    {
+        return selectBestFunctions().skipDigits(data, pos, size);
+    }
+
+    size_t firstUseFindEither(const char* data, size_t pos, size_t size, char first, char second)
+    {
+        return selectBestFunctions().findEither(data, pos, size, first, second);
+    }
+
+    size_t firstUseFindBlockCommentEnd(const char* data, size_t pos, size_t size)
+    {
+        return selectBestFunctions().findBlockCommentEnd(data, pos, size);
+    }
+
+    constexpr ScanFunctions firstUseFunctions { firstUseSkipWhitespace, firstUseSkipDigits, firstUseFindEither, firstUseFindBlockCommentEnd };
+
+    // Until the first search, this points at functions that detect the processor and then
+    // forward the call, so every search costs just a load and an indirect call
+    std::atomic<const ScanFunctions*> selectedFunctions { &firstUseFunctions };
+
+    const ScanFunctions& selectBestFunctions()
+    {
+        // Keeps an instruction set chosen with setInstructionSet() in the meantime
+        const ScanFunctions* expected = &firstUseFunctions;
+        selectedFunctions.compare_exchange_strong(expected, &functionsFor(MMLScanner::getBestSupportedInstructionSet()));
+        return *selectedFunctions.load();
+    }
+}
+
+size_t MMLScanner::skipWhitespace(const char* data, size_t pos, size_t size)
+{
+    return selectedFunctions.load(std::memory_order_relaxed)->skipWhitespace(data, pos, size);
+}
+
+size_t MMLScanner::skipDigits(const char* data, size_t pos, size_t size)
+{
+    return selectedFunctions.load(std::memory_order_relaxed)->skipDigits(data, pos, size);
+}
+
+size_t MMLScanner::findEither(const char* data, size_t pos, size_t size, char first, char second)
+{
+    return selectedFunctions.load(std::memory_order_relaxed)->findEither(data, pos, size, first, second);
+}
+
+size_t MMLScanner::findBlockCommentEnd(const char* data, size_t pos, size_t size)
+{
+    return selectedFunctions.load(std::memory_order_relaxed)->findBlockCommentEnd(data, pos, size);
+}
+
+MMLScanner::InstructionSet MMLScanner::getInstructionSet()
+{
+    const ScanFunctions* functions = selectedFunctions.load();
+
+    if (functions == &firstUseFunctions)
+        functions = &selectBestFunctions();
+
+   #if MML_SCANNER_X64
+    if (functions == &avx2Functions)
+        return InstructionSet::AVX2;
+
+    if (functions == &sse2Functions)
+        return InstructionSet::SSE2;
+   #endif
+
+    return InstructionSet::Scalar;
+}
+
+void MMLScanner::setInstructionSet(InstructionSet instructionSet)
+{
+    const InstructionSet best = getBestSupportedInstructionSet();
+    selectedFunctions.store(&functionsFor(instructionSet > best ? best : instructionSet));
+}
+
+MMLScanner::InstructionSet MMLScanner::getBestSupportedInstructionSet()
+{
+   #if MML_SCANNER_X64
+    static const bool hasAVX2 = processorHasAVX2();
+    return hasAVX2 ? InstructionSet::AVX2 : InstructionSet::SSE2;
+   #else
+    return InstructionSet::Scalar;
+   #endif
+}
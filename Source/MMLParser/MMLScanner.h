@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * MMLScanner - Vectorized search over runs of whitespace, digits and comment text
+ *
+ * Generated scores are often mostly whitespace, numbers and comment blocks, which
+ * the lexer would otherwise step through one byte at a time. These functions test
+ * 16 bytes (SSE2) or 32 bytes (AVX2) per step. The instruction set is chosen at
+ * first use from what the processor supports; other processors use plain loops,
+ * which give the same results.
+ *
+ * Every search starts at a byte offset into a buffer and returns the offset where
+ * the run ends, or the buffer size if it reaches the end. Nothing past the end of
+ * the buffer is read.
+ */
+class MMLScanner
+{
+public:
+    enum class InstructionSet
+    {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    /**
+     * Finds the end of a run of whitespace (space, tab, newline, carriage return, form feed, vertical tab).
+     * @param data Buffer to search.
+     * @param pos Offset to start at.
+     * @param size Size of the buffer in bytes.
+     * @return Offset of the first byte at or after pos that is not whitespace, or size.
+     */
+    static size_t skipWhitespace(const char* data, size_t pos, size_t size);
+
+    /**
+     * Finds the end of a run of decimal digits.
+     * @param data Buffer to search.
+     * @param pos Offset to start at.
+     * @param size Size of the buffer in bytes.
+     * @return Offset of the first byte at or after pos that is not a digit, or size.
+     */
+    static size_t skipDigits(const char* data, size_t pos, size_t size);
+
+    /**
+     * Finds the next occurrence of either of two bytes.
+     * @param data Buffer to search.
+     * @param pos Offset to start at.
+     * @param size Size of the buffer in bytes.
+     * @param first One byte to look for.
+     * @param second The other byte to look for (may equal first).
+     * @return Offset of the first matching byte at or after pos, or size.
+     */
+    static size_t findEither(const char* data, size_t pos, size_t size, char first, char second);
+
+    /**
+     * Finds the end of a block comment: the next asterisk followed by a slash.
+     * @param data Buffer to search.
+     * @param pos Offset to start at.
+     * @param size Size of the buffer in bytes.
+     * @return Offset of the asterisk of the first such pair at or after pos, or size if there is none.
+     */
+    static size_t findBlockCommentEnd(const char* data, size_t pos, size_t size);
+
+    /**
+     * Gets the instruction set the searches currently use.
+     * @return Instruction set in use.
+     */
+    static InstructionSet getInstructionSet();
+
+    /**
+     * Chooses the instruction set the searches use, for benchmarking and comparing
+     * implementations. Sets the processor does not support fall back to the best one it does.
+     * @param instructionSet Instruction set to use.
+     */
+    static void setInstructionSet(InstructionSet instructionSet);
+
+    /**
+     * Gets the fastest instruction set the processor supports, which is used by default.
+     * @return Best supported instruction set.
+     */
+    static InstructionSet getBestSupportedInstructionSet();
+};
@@ -0,0 +1,92 @@
+#include "MMLTempoMap.h"
+#include "MMLTime.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+namespace
+{
+    double secondsPerTickAt(double tempo)
+    {
+        return 60.0 / (tempo * MMLTime::ticksPerQuarterNote);
+    }
+
+    // Only a tempo that is exactly the same adds no segment, so the compare is deliberately exact
+    bool isSameTempo(double a, double b)
+    {
+        return std::equal_to<double>()(a, b);
+    }
+}
+
+MMLTempoMap::Segment MMLTempoMap::Segment::atStart(double initialTempo)
+{
+    return { 0, 0.0, secondsPerTickAt(initialTempo), initialTempo };
+}
+
+MMLTempoMap::Segment MMLTempoMap::Segment::withTempoChange(int64_t tick, double newTempo) const
+{
+    // Later change at the same position wins
+    if (tick <= startTick)
+        return { startTick, startSeconds, secondsPerTickAt(newTempo), newTempo };
+
+    if (isSameTempo(newTempo, tempo))
+        return *this;
+
+    return { tick, tickToSeconds(tick), secondsPerTickAt(newTempo), newTempo };
+}
+
+double MMLTempoMap::Segment::tickToSeconds(int64_t tick) const
+{
+    return startSeconds + static_cast<double>(tick - startTick) * secondsPerTick;
+}
+
+int64_t MMLTempoMap::Segment::tickToSample(int64_t tick, double sampleRate) const
+{
+    return static_cast<int64_t>(std::llround(tickToSeconds(tick) * sampleRate));
+}
+
+MMLTempoMap::MMLTempoMap()
+{
+    reset();
+}
+
+void MMLTempoMap::reset(double initialTempo)
+{
+    segments.clear();
+    segments.push_back(Segment::atStart(initialTempo));
+}
+
+void MMLTempoMap::addTempoChange(int64_t tick, double tempo)
+{
+    Segment& last = segments.back();
+    const Segment next = last.withTempoChange(tick, tempo);
+
+    if (next.startTick == last.startTick)
+        last = next;
+    else
+        segments.push_back(next);
+}
+
+double MMLTempoMap::tickToSeconds(int64_t tick) const
+{
+    return findSegment(tick).tickToSeconds(tick);
+}
+
+int64_t MMLTempoMap::tickToSample(int64_t tick, double sampleRate) const
+{
+    return findSegment(tick).tickToSample(tick, sampleRate);
+}
+
+double MMLTempoMap::getTempoAt(int64_t tick) const
+{
+    return findSegment(tick).tempo;
+}
+
+const MMLTempoMap::Segment& MMLTempoMap::findSegment(int64_t tick) const
+{
+    // Last segment starting at or before the tick; the first segment always starts at 0
+    auto it = std::upper_bound(segments.begin(), segments.end(), tick,
+                               [] (int64_t value, const Segment& segment) { return value < segment.startTick; });
+
+    return it == segments.begin() ? *it : *(it - 1);
+}
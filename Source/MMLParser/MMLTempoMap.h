@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * MMLTempoMap - Piecewise-linear mapping from ticks to real time
+ *
+ * Each tempo change starts a new segment. The start time of every segment is
+ * precomputed as changes are added, so converting a tick to seconds or samples
+ * is a binary search over the segments followed by one multiply-add.
+ */
+class MMLTempoMap
+{
+public:
+    /** Creates a map with a single segment at the default tempo. */
+    MMLTempoMap();
+
+    /**
+     * Resets the map to a single segment.
+     * @param initialTempo Tempo in BPM from tick 0.
+     */
+    void reset(double initialTempo = defaultTempo);
+
+    /**
+     * Adds a tempo change. Changes must be added in non-decreasing tick order;
+     * a change at the same tick as the previous one replaces it.
+     * @param tick Position of the change in ticks.
+     * @param tempo New tempo in BPM.
+     */
+    void addTempoChange(int64_t tick, double tempo);
+
+    /** Converts a tick position to seconds from tick 0. */
+    double tickToSeconds(int64_t tick) const;
+
+    /** Converts a tick position to a sample position at the given sample rate. */
+    int64_t tickToSample(int64_t tick, double sampleRate) const;
+
+    /** Gets the tempo in BPM at a tick position. */
+    double getTempoAt(int64_t tick) const;
+
+    /** Gets the number of constant-tempo segments. */
+    int getNumSegments() const { return static_cast<int>(segments.size()); }
+
+    static constexpr double defaultTempo = 120.0;
+
+    /**
+     * A stretch of constant tempo. Playback that walks tempo changes in order, such
+     * as MMLEventStream, only needs the current segment; it advances it with the same
+     * calls the map uses, so both give identical positions.
+     */
+    struct Segment
+    {
+        int64_t startTick;
+        double startSeconds;
+        double secondsPerTick;
+        double tempo;
+
+        /** Creates the segment that starts at tick 0 with the given tempo. */
+        static Segment atStart(double initialTempo);
+
+        /**
+         * Gets the segment in effect after a tempo change at or after startTick.
+         * A change at startTick replaces this segment's tempo, and a change to the
+         * same tempo leaves it as it is.
+         * @param tick Position of the change in ticks.
+         * @param newTempo New tempo in BPM.
+         * @return The segment that covers the tick.
+         */
+        Segment withTempoChange(int64_t tick, double newTempo) const;
+
+        /** Converts a tick at or after startTick to seconds from tick 0. */
+        double tickToSeconds(int64_t tick) const;
+
+        /** Converts a tick at or after startTick to a sample position at the given sample rate. */
+        int64_t tickToSample(int64_t tick, double sampleRate) const;
+    };
+
+private:
+    const Segment& findSegment(int64_t tick) const;
+
+    std::vector<Segment> segments;
+};
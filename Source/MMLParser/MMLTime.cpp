@@ -0,0 +1,92 @@
+#include "MMLTime.h"
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace MMLTime
+{
+    namespace
+    {
+        constexpr int64_t maxValue = std::numeric_limits<int64_t>::max();
+
+        bool multiplyChecked(int64_t a, int64_t b, int64_t& result)
+        {
+            if (a != 0 && b > maxValue / a)
+                return false;
+
+            result = a * b;
+            return true;
+        }
+
+        Rational roundedToTicks(long double ticks)
+        {
+            return Rational(static_cast<int64_t>(std::llround(ticks)));
+        }
+
+        long double toTicks(const Rational& value)
+        {
+            return static_cast<long double>(value.getNumerator()) / value.getDenominator();
+        }
+    }
+
+    Rational::Rational(int64_t n, int64_t d)
+        : numerator(n), denominator(d)
+    {
+        const int64_t divisor = std::gcd(numerator, denominator);
+
+        if (divisor > 1)
+        {
+            numerator /= divisor;
+            denominator /= divisor;
+        }
+    }
+
+    Rational Rational::operator+(const Rational& other) const
+    {
+        // Whole-tick values (the common case with standard note lengths) stay on the fast path
+        if (denominator == 1 && other.denominator == 1)
+            return Rational(numerator + other.numerator);
+
+        const int64_t divisor = std::gcd(denominator, other.denominator);
+        const int64_t scaleThis = other.denominator / divisor;
+        const int64_t scaleOther = denominator / divisor;
+
+        int64_t commonDenominator, left, right;
+        if (multiplyChecked(denominator, scaleThis, commonDenominator)
+            && multiplyChecked(numerator, scaleThis, left)
+            && multiplyChecked(other.numerator, scaleOther, right)
+            && left <= maxValue - right)
+        {
+            return Rational(left + right, commonDenominator);
+        }
+
+        return roundedToTicks(toTicks(*this) + toTicks(other));
+    }
+
+    Rational Rational::operator*(const Rational& other) const
+    {
+        // Cross-reduce first to keep the intermediate products small
+        const int64_t divisorA = std::gcd(numerator, other.denominator);
+        const int64_t divisorB = std::gcd(other.numerator, denominator);
+
+        int64_t resultNumerator, resultDenominator;
+        if (multiplyChecked(numerator / divisorA, other.numerator / divisorB, resultNumerator)
+            && multiplyChecked(denominator / divisorB, other.denominator / divisorA, resultDenominator))
+        {
+            return Rational(resultNumerator, resultDenominator);
+        }
+
+        return roundedToTicks(toTicks(*this) * toTicks(other));
+    }
+
+    Rational Rational::operator/(const Rational& other) const
+    {
+        return *this * Rational(other.denominator, other.numerator);
+    }
+
+    Rational lengthFromDenominator(int lengthDenominator, bool isDotted)
+    {
+        return isDotted ? Rational(ticksPerWholeNote * 3, static_cast<int64_t>(lengthDenominator) * 2)
+                        : Rational(ticksPerWholeNote, lengthDenominator);
+    }
+}
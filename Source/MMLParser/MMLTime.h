@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * MMLTime - Integer tick timebase shared by the compiler and playback
+ *
+ * All musical time is measured in ticks at ticksPerQuarterNote resolution.
+ * Positions are accumulated as exact fractions of a tick, so lengths that do not
+ * divide the timebase evenly (such as "c7" or a 7-note tuplet) never build up
+ * rounding error. Only the integer tick of each event is taken, when it is emitted.
+ */
+namespace MMLTime
+{
+    constexpr int ticksPerQuarterNote = 1920;
+    constexpr int64_t ticksPerWholeNote = 4 * ticksPerQuarterNote;
+
+    /** Largest MML length denominator accepted ("c7680" is one tick). */
+    constexpr int maxLengthDenominator = static_cast<int>(ticksPerWholeNote);
+
+    /**
+     * A non-negative tick count stored as a reduced fraction.
+     * If an operation would overflow 64 bits, the result is rounded to whole ticks.
+     */
+    class Rational
+    {
+    public:
+        Rational() : numerator(0), denominator(1) {}
+        Rational(int64_t numerator, int64_t denominator = 1);
+
+        Rational operator+(const Rational& other) const;
+        Rational operator*(const Rational& other) const;
+        Rational operator/(const Rational& other) const;
+        Rational& operator+=(const Rational& other) { return *this = *this + other; }
+
+        bool operator==(const Rational& other) const { return numerator == other.numerator && denominator == other.denominator; }
+        bool operator!=(const Rational& other) const { return !(*this == other); }
+
+        /** Gets the whole number of ticks, rounded down. */
+        int64_t floor() const { return numerator / denominator; }
+
+        bool isZero() const { return numerator == 0; }
+
+        int64_t getNumerator() const { return numerator; }
+        int64_t getDenominator() const { return denominator; }
+
+    private:
+        int64_t numerator;
+        int64_t denominator;
+    };
+
+    /**
+     * Gets the length of an MML note value in ticks.
+     * @param lengthDenominator MML length (4 = quarter note); must be greater than zero.
+     * @param isDotted True to extend the length by half.
+     */
+    Rational lengthFromDenominator(int lengthDenominator, bool isDotted);
+
+    /** Converts a tick count to quarter notes. */
+    inline double ticksToQuarterNotes(int64_t ticks)
+    {
+        return static_cast<double>(ticks) / ticksPerQuarterNote;
+    }
+}
@@ -0,0 +1,1046 @@
+#include "MMLTrackParser.h"
+#include <climits>
+#include <algorithm>
+#include <limits>
+
+MMLTrackParser::MMLCommand::MMLCommand()
+    : type(Type::Note), noteName('c'), accidental(0), isDotted(false), isTied(false), value(0), bodySize(0), offset(0) {}
+
+MMLTrackParser::MMLLoop::MMLLoop()
+    : startPos(0), count(2) {}
+
+MMLTrackParser::ParseResult::ParseResult()
+    : totalDuration(0) {}
+
+void MMLTrackParser::ParseResult::clear()
+{
+    // Keeps the capacity, so parsing a score of similar size again does not allocate
+    notes.clear();
+    tempoEvents.clear();
+    totalDuration = 0;
+}
+
+void MMLTrackParser::NoteArrays::clear()
+{
+    startTicks.clear();
+    lengthTicks.clear();
+    pitches.clear();
+    velocities.clear();
+    flags.clear();
+}
+
+void MMLTrackParser::NoteArrays::add(juce::int64 startTick, juce::int32 length, juce::uint8 pitch, juce::uint8 velocity,
+                                     juce::uint8 noteFlags)
+{
+    startTicks.push_back(startTick);
+    lengthTicks.push_back(length);
+    pitches.push_back(pitch);
+    velocities.push_back(velocity);
+    flags.push_back(noteFlags);
+}
+
+void MMLTrackParser::NoteArrays::truncate(size_t numNotes)
+{
+    startTicks.resize(numNotes);
+    lengthTicks.resize(numNotes);
+    pitches.resize(numNotes);
+    velocities.resize(numNotes);
+    flags.resize(numNotes);
+}
+
+void MMLTrackParser::NoteArrays::appendFrom(const NoteArrays& source, size_t first)
+{
+    auto append = [first] (auto& destination, const auto& sourceArray)
+    {
+        destination.insert(destination.end(), sourceArray.begin() + static_cast<std::ptrdiff_t>(first), sourceArray.end());
+    };
+    
+    append(startTicks, source.startTicks);
+    append(lengthTicks, source.lengthTicks);
+    append(pitches, source.pitches);
+    append(velocities, source.velocities);
+    append(flags, source.flags);
+}
+
+void MMLTrackParser::NoteArrays::shiftFrom(size_t first, juce::int64 ticks)
+{
+    // One contiguous array of integers, so the compiler vectorizes this
+    juce::int64* const ticksData = startTicks.data();
+    const size_t numNotes = startTicks.size();
+    
+    for (size_t i = first; i < numNotes; i++)
+        ticksData[i] += ticks;
+}
+
+MMLTrackParser::ParseState::ParseState()
+    : position(0), tupletStart(-1) {}
+
+MMLTrackParser::Checkpoint::Checkpoint()
+    : tokenIndex(0), commandIndex(0), programOffset(0), noteIndex(0), tempoEventIndex(0) {}
+
+MMLTrackParser::ReparseTail::ReparseTail()
+    : totalDuration(0), byteShift(0), firstKeptToken(0), tokenShift(0), firstKeptCheckpoint(0) {}
+
+void MMLTrackParser::ReparseTail::clear()
+{
+    start = Checkpoint();
+    tokens.clear();
+    commands.clear();
+    program.clear();
+    notes.clear();
+    tempoEvents.clear();
+    checkpoints.clear();
+    totalDuration = 0;
+    byteShift = 0;
+    firstKeptToken = 0;
+    tokenShift = 0;
+    firstKeptCheckpoint = 0;
+}
+
+MMLTrackParser::MMLTrackParser()
+    : sourceOffset(0), canReparse(false), expanded(false), cancelFlag(nullptr)
+{
+}
+
+MMLTrackParser::~MMLTrackParser()
+{
+}
+
+bool MMLTrackParser::parse(std::string_view trackText, juce::uint32 offset)
+{
+    parseResult.clear();
+    errorMessage = "";
+    canReparse = false;
+    sourceOffset = offset;
+    commands.clear();
+    program.clear();
+    reparseTail.clear();
+    
+    MMLLexer::tokenize(trackText, tokens);
+    
+    checkpoints.assign(1, Checkpoint()); // The start of the score
+    
+    return buildFrom(0, trackText);
+}
+
+bool MMLTrackParser::reparse(std::string_view trackText, juce::uint32 offset)
+{
+    if (!canReparse)
+        return parse(trackText, offset);
+        
+    // Offsets are kept relative to the track, so moving the whole track costs nothing
+    sourceOffset = offset;
+    
+    const size_t oldSize = source.size();
+    const size_t newSize = trackText.size();
+    const size_t commonSize = std::min(oldSize, newSize);
+    
+    // Only the bytes between the common prefix and the common suffix have changed
+    const size_t prefix = static_cast<size_t>(std::mismatch(source.begin(), source.begin() + static_cast<std::ptrdiff_t>(commonSize),
+                                                            trackText.begin()).first - source.begin());
+                                                            
+    if (prefix == oldSize && prefix == newSize)
+        return true;
+        
+    size_t suffix = 0;
+    while (suffix < commonSize - prefix && source[oldSize - 1 - suffix] == trackText[newSize - 1 - suffix])
+        suffix++;
+        
+    errorMessage = "";
+    canReparse = false;
+    
+    // Restart at the last checkpoint whose command starts before the first changed byte.
+    // Checkpoints are only placed on command tokens, which the previous command never
+    // looks past, so everything before the restart point is unaffected by the edit.
+    const auto restart = std::partition_point(checkpoints.begin() + 1, checkpoints.end(),
+                                              [this, prefix] (const Checkpoint& checkpoint)
+                                              {
+                                                  return tokens[static_cast<size_t>(checkpoint.tokenIndex)].offset < prefix;
+                                              }) - 1;
+    const int startCheckpoint = static_cast<int>(restart - checkpoints.begin());
+    ReparseTail& tail = reparseTail;
+    
+    tail.start = *restart;
+    tail.totalDuration = parseResult.totalDuration;
+    tail.byteShift = static_cast<juce::int64>(newSize) - static_cast<juce::int64>(oldSize);
+    
+    // Set aside everything after the restart point, to be reused once the parses agree again
+    tail.checkpoints.assign(restart + 1, checkpoints.end());
+    checkpoints.erase(restart + 1, checkpoints.end());
+    
+    tail.tokens.assign(tokens.begin() + tail.start.tokenIndex, tokens.end());
+    tokens.resize(static_cast<size_t>(tail.start.tokenIndex));
+    
+    tail.commands.assign(commands.begin() + tail.start.commandIndex, commands.end());
+    commands.resize(static_cast<size_t>(tail.start.commandIndex));
+    
+    tail.program.assign(program.getData() + tail.start.programOffset, program.getData() + program.getSize());
+    program.truncate(tail.start.programOffset);
+    
+    auto& notes = parseResult.notes;
+    tail.notes.clear();
+    tail.notes.appendFrom(notes, tail.start.noteIndex);
+    notes.truncate(tail.start.noteIndex);
+    
+    auto& tempoEvents = parseResult.tempoEvents;
+    tail.tempoEvents.assign(tempoEvents.begin() + static_cast<std::ptrdiff_t>(tail.start.tempoEventIndex), tempoEvents.end());
+    tempoEvents.resize(tail.start.tempoEventIndex);
+    
+    // Lex the changed text until a token starts where an old token did within the unchanged
+    // suffix: the lexer carries nothing over between tokens, so the old tokens are valid from there
+    size_t position = (startCheckpoint == 0 || tail.tokens.empty()) ? 0 : tail.tokens.front().offset;
+    size_t stopOffset = newSize - suffix;
+    size_t keptToken = 0;
+    
+    for (;;)
+    {
+        position = MMLLexer::tokenizeRange(trackText, position, stopOffset, tokens);
+        
+        if (position >= newSize)
+        {
+            keptToken = tail.tokens.size();
+            break;
+        }
+        
+        const auto oldOffset = static_cast<juce::int64>(position) - tail.byteShift;
+        while (keptToken < tail.tokens.size() && tail.tokens[keptToken].offset < oldOffset)
+            keptToken++;
+            
+        if (keptToken < tail.tokens.size() && tail.tokens[keptToken].offset == oldOffset)
+            break;
+            
+        stopOffset = position + 1;
+    }
+    
+    tail.firstKeptToken = tail.start.tokenIndex + static_cast<int>(keptToken);
+    tail.tokenShift = static_cast<int>(tokens.size()) - tail.firstKeptToken;
+    
+    const size_t firstNewToken = tokens.size();
+    tokens.insert(tokens.end(), tail.tokens.begin() + static_cast<std::ptrdiff_t>(keptToken), tail.tokens.end());
+    
+    if (tail.byteShift != 0)
+        for (size_t i = firstNewToken; i < tokens.size(); i++)
+            tokens[i].offset = static_cast<juce::uint32>(tokens[i].offset + tail.byteShift);
+            
+    return buildFrom(startCheckpoint, trackText);
+}
+
+bool MMLTrackParser::buildFrom(int startCheckpoint, std::string_view trackText)
+{
+    // Pass 1: build the command tree (each token is visited exactly once)
+    if (!buildCommands(startCheckpoint))
+        return false;
+        
+    // Pass 2: lower the command tree to bytecode
+    buildProgram(startCheckpoint);
+    
+    source.assign(trackText.data(), trackText.size());
+    
+    // Too long to expand: the track is played straight from its bytecode (see MMLEventStream).
+    // Expanded notes and checkpoint states are left out, so the next edit parses it in full.
+    expanded = program.countTimedEvents() <= maxExpandedNotes;
+    
+    if (!expanded)
+    {
+        parseResult = ParseResult();
+        return true;
+    }
+    
+    // Pass 3: run the program to expand it into timed notes
+    if (!buildNotes(startCheckpoint))
+        return false;
+        
+    canReparse = true;
+    return true;
+}
+
+bool MMLTrackParser::isExpanded() const
+{
+    return expanded;
+}
+
+bool MMLTrackParser::isUpToDate(std::string_view trackText) const
+{
+    return canReparse && trackText == source;
+}
+
+bool MMLTrackParser::buildCommands(int startCheckpoint)
+{
+    // A member, so that the loop stack keeps its storage from one parse to the next
+    ParseState& state = parseState;
+    state.position = static_cast<size_t>(checkpoints[static_cast<size_t>(startCheckpoint)].tokenIndex);
+    state.tupletStart = -1;
+    state.loops.clear();
+    
+    const size_t numTokens = tokens.size();
+    int tokensUntilCancelCheck = cancelCheckInterval;
+    size_t nextKept = 0;
+    
+    while (state.position < numTokens)
+    {
+        if (--tokensUntilCancelCheck == 0)
+        {
+            if (checkCancelled())
+                return false;
+                
+            tokensUntilCancelCheck = cancelCheckInterval;
+        }
+        
+        const TokenRule& rule = tokenRules[static_cast<int>(tokens[state.position].type)];
+        
+        if (state.loops.empty() && state.tupletStart < 0 && rule.startsCommand)
+        {
+            // Back at a checkpoint of the previous parse: the remaining tokens, and so the commands, are unchanged
+            if (reachesKeptCheckpoint(static_cast<int>(state.position), nextKept))
+            {
+                keepCommandsFrom(nextKept);
+                return true;
+            }
+            
+            if (static_cast<int>(commands.size()) - checkpoints.back().commandIndex >= checkpointInterval)
+            {
+                Checkpoint checkpoint;
+                checkpoint.tokenIndex = static_cast<int>(state.position);
+                checkpoint.commandIndex = static_cast<int>(commands.size());
+                checkpoints.push_back(checkpoint);
+            }
+        }
+        
+        if (state.tupletStart >= 0 && !rule.allowedInTuplet)
+        {
+            errorMessage = "Only notes, rests and octave changes are allowed in a tuplet at position "
+                         + formatPosition(tokens[state.position].offset);
+            return false;
+        }
+        
+        if (!(this->*rule.parse)(state))
+            return false;
+    }
+    
+    if (state.tupletStart >= 0)
+    {
+        errorMessage = "Unterminated tuplet at position " + formatPosition(commands[static_cast<size_t>(state.tupletStart)].offset);
+        return false;
+    }
+    
+    // Unterminated loops keep their body and play it once
+    state.loops.clear();
+    
+    reparseTail.firstKeptCheckpoint = static_cast<int>(checkpoints.size());
+    return true;
+}
+
+bool MMLTrackParser::reachesKeptCheckpoint(int position, size_t& nextKept) const
+{
+    const ReparseTail& tail = reparseTail;
+    
+    while (nextKept < tail.checkpoints.size())
+    {
+        const int oldIndex = tail.checkpoints[nextKept].tokenIndex;
+        
+        // Checkpoints in the relexed region or already passed can never be reached
+        if (oldIndex < tail.firstKeptToken || oldIndex + tail.tokenShift < position)
+        {
+            nextKept++;
+            continue;
+        }
+        
+        return oldIndex + tail.tokenShift == position;
+    }
+    
+    return false;
+}
+
+void MMLTrackParser::keepCommandsFrom(size_t keptCheckpoint)
+{
+    ReparseTail& tail = reparseTail;
+    const Checkpoint& kept = tail.checkpoints[keptCheckpoint];
+    const int commandShift = static_cast<int>(commands.size()) - kept.commandIndex;
+    
+    const size_t firstNewCommand = commands.size();
+    commands.insert(commands.end(), tail.commands.begin() + (kept.commandIndex - tail.start.commandIndex), tail.commands.end());
+    
+    if (tail.byteShift != 0)
+        for (size_t i = firstNewCommand; i < commands.size(); i++)
+            commands[i].offset = static_cast<juce::uint32>(commands[i].offset + tail.byteShift);
+            
+    tail.firstKeptCheckpoint = static_cast<int>(checkpoints.size());
+    
+    for (size_t i = keptCheckpoint; i < tail.checkpoints.size(); i++)
+    {
+        checkpoints.push_back(tail.checkpoints[i]);
+        checkpoints.back().tokenIndex += tail.tokenShift;
+        checkpoints.back().commandIndex += commandShift;
+    }
+}
+
+void MMLTrackParser::buildProgram(int startCheckpoint)
+{
+    const ReparseTail& tail = reparseTail;
+    const int numCheckpoints = static_cast<int>(checkpoints.size());
+    
+    for (int i = startCheckpoint; i < numCheckpoints; i++)
+    {
+        Checkpoint& checkpoint = checkpoints[static_cast<size_t>(i)];
+        
+        if (i == tail.firstKeptCheckpoint)
+        {
+            // Bytecode holds no absolute positions, so the rest of the old program is reused as is
+            const size_t oldOffset = checkpoint.programOffset;
+            const size_t newOffset = program.getSize();
+            const size_t keptOffset = oldOffset - tail.start.programOffset;
+            program.append(tail.program.data() + keptOffset, tail.program.size() - keptOffset);
+            
+            for (int j = i; j < numCheckpoints; j++)
+                checkpoints[static_cast<size_t>(j)].programOffset = checkpoints[static_cast<size_t>(j)].programOffset - oldOffset + newOffset;
+                
+            return;
+        }
+        
+        const int endCommand = i + 1 < numCheckpoints ? checkpoints[static_cast<size_t>(i + 1)].commandIndex
+                                                      : static_cast<int>(commands.size());
+        checkpoint.programOffset = program.getSize();
+        compileCommands(checkpoint.commandIndex, endCommand);
+    }
+}
+
+bool MMLTrackParser::buildNotes(int startCheckpoint)
+{
+    const ReparseTail& tail = reparseTail;
+    auto& notes = parseResult.notes;
+    const int numCheckpoints = static_cast<int>(checkpoints.size());
+    
+    MMLInterpreter interpreter(program);
+    MMLInterpreter::Event event;
+    int eventsUntilCancelCheck = cancelCheckInterval;
+    
+    interpreter.restart(checkpoints[static_cast<size_t>(startCheckpoint)].programOffset,
+                        checkpoints[static_cast<size_t>(startCheckpoint)].state);
+                        
+    for (int i = startCheckpoint; i < numCheckpoints; i++)
+    {
+        Checkpoint& checkpoint = checkpoints[static_cast<size_t>(i)];
+        
+        // Once the musical state matches the previous parse, the rest only moves in time
+        juce::int64 tickShift = 0;
+        if (i >= tail.firstKeptCheckpoint && getTickShift(interpreter.getState(), checkpoint.state, tickShift))
+        {
+            keepNotesFrom(i, tickShift);
+            return true;
+        }
+        
+        checkpoint.state = interpreter.getState();
+        checkpoint.noteIndex = notes.size();
+        checkpoint.tempoEventIndex = parseResult.tempoEvents.size();
+        
+        interpreter.setEndPosition(i + 1 < numCheckpoints ? checkpoints[static_cast<size_t>(i + 1)].programOffset
+                                                          : program.getSize());
+                                                          
+        while (interpreter.next(event))
+        {
+            if (--eventsUntilCancelCheck == 0)
+            {
+                if (checkCancelled())
+                    return false;
+                    
+                eventsUntilCancelCheck = cancelCheckInterval;
+            }
+            
+            if (event.type == MMLInterpreter::Event::Type::Tempo)
+                parseResult.tempoEvents.push_back({ event.tick, event.value });
+                
+            if (event.type != MMLInterpreter::Event::Type::Note)
+                continue;
+                
+            notes.add(event.tick, static_cast<juce::int32>(event.lengthTicks),
+                      static_cast<juce::uint8>(MMLInterpreter::midiNoteNumber(event.noteName, event.accidental, event.octave)),
+                      MMLMidiEvent::noteOnVelocity, event.isTied ? NoteArrays::tied : 0);
+        }
+    }
+    
+    parseResult.totalDuration = interpreter.getState().currentTime.floor();
+    
+    return true;
+}
+
+void MMLTrackParser::keepNotesFrom(int checkpointIndex, juce::int64 tickShift)
+{
+    const ReparseTail& tail = reparseTail;
+    auto& notes = parseResult.notes;
+    auto& tempoEvents = parseResult.tempoEvents;
+    const Checkpoint& kept = checkpoints[static_cast<size_t>(checkpointIndex)];
+    const size_t newNoteIndex = notes.size();
+    const size_t newTempoEventIndex = tempoEvents.size();
+    
+    notes.appendFrom(tail.notes, kept.noteIndex - tail.start.noteIndex);
+    tempoEvents.insert(tempoEvents.end(), tail.tempoEvents.begin() + static_cast<std::ptrdiff_t>(kept.tempoEventIndex - tail.start.tempoEventIndex),
+                       tail.tempoEvents.end());
+                       
+    if (tickShift != 0)
+    {
+        notes.shiftFrom(newNoteIndex, tickShift);
+        
+        for (size_t i = newTempoEventIndex; i < tempoEvents.size(); i++)
+            tempoEvents[i].tick += tickShift;
+    }
+    
+    const size_t oldNoteIndex = kept.noteIndex;
+    const size_t oldTempoEventIndex = kept.tempoEventIndex;
+    
+    for (size_t i = static_cast<size_t>(checkpointIndex); i < checkpoints.size(); i++)
+    {
+        Checkpoint& checkpoint = checkpoints[i];
+        const MMLTime::Rational& time = checkpoint.state.currentTime;
+        
+        checkpoint.noteIndex = checkpoint.noteIndex - oldNoteIndex + newNoteIndex;
+        checkpoint.tempoEventIndex = checkpoint.tempoEventIndex - oldTempoEventIndex + newTempoEventIndex;
+        checkpoint.state.currentTime = MMLTime::Rational(time.getNumerator() + tickShift * time.getDenominator(),
+                                                         time.getDenominator());
+    }
+    
+    parseResult.totalDuration = tail.totalDuration + tickShift;
+}
+
+bool MMLTrackParser::getTickShift(const MMLInterpreter::State& current, const MMLInterpreter::State& previous,
+                                     juce::int64& tickShift)
+{
+    if (current.octave != previous.octave || current.defaultLength != previous.defaultLength
+        || current.tempo != previous.tempo || current.volume != previous.volume)
+        return false;
+        
+    // Positions are reduced fractions, so a whole-tick difference needs equal denominators.
+    // Anything else would round differently, so the old notes could not simply be moved.
+    const juce::int64 denominator = current.currentTime.getDenominator();
+    const juce::int64 difference = current.currentTime.getNumerator() - previous.currentTime.getNumerator();
+    
+    if (denominator != previous.currentTime.getDenominator() || difference % denominator != 0)
+        return false;
+        
+    tickShift = difference / denominator;
+    return true;
+}
+
+void MMLTrackParser::generateEvents(std::vector<MMLMidiEvent>& events, int channel)
+{
+    const auto noteOn = static_cast<uint8_t>(0x90 | (channel - 1));
+    const auto noteOff = static_cast<uint8_t>(0x80 | (channel - 1));
+    const NoteArrays& notes = parseResult.notes;
+    const size_t numNotes = notes.size();
+    
+    // Presize exactly: one note-on per note, plus a note-off unless it is tied
+    size_t numEvents = 2 * numNotes;
+    for (size_t i = 0; i < numNotes; i++)
+        numEvents -= static_cast<size_t>(notes.flags[i] & NoteArrays::tied);
+        
+    events.clear();
+    events.reserve(numEvents);
+    pendingNoteOffs.clear();
+    
+    // Notes start in tick order, so only the note-offs need merging in. The earliest pending
+    // note-off is kept on top, and is emitted before any note-on at the same tick.
+    auto endsLater = [] (const PendingNoteOff& a, const PendingNoteOff& b)
+    {
+        return a.tick != b.tick ? a.tick > b.tick : a.noteIndex > b.noteIndex;
+    };
+    
+    auto releaseUntil = [&] (juce::int64 tick)
+    {
+        while (!pendingNoteOffs.empty() && pendingNoteOffs.front().tick <= tick)
+        {
+            std::pop_heap(pendingNoteOffs.begin(), pendingNoteOffs.end(), endsLater);
+            const PendingNoteOff& off = pendingNoteOffs.back();
+            events.push_back({ off.tick, { noteOff, off.midiNote, 0 } });
+            pendingNoteOffs.pop_back();
+        }
+    };
+    
+    for (size_t i = 0; i < numNotes; i++)
+    {
+        const juce::int64 startTick = notes.startTicks[i];
+        const juce::uint8 pitch = notes.pitches[i];
+        
+        releaseUntil(startTick);
+        events.push_back({ startTick, { noteOn, pitch, notes.velocities[i] } });
+        
+        if ((notes.flags[i] & NoteArrays::tied) == 0)
+        {
+            pendingNoteOffs.push_back({ startTick + notes.lengthTicks[i], static_cast<juce::uint32>(i), pitch });
+            std::push_heap(pendingNoteOffs.begin(), pendingNoteOffs.end(), endsLater);
+        }
+    }
+    
+    releaseUntil(std::numeric_limits<juce::int64>::max());
+}
+
+juce::String MMLTrackParser::getError() const
+{
+    return errorMessage;
+}
+
+const MMLProgram& MMLTrackParser::getProgram() const
+{
+    return program;
+}
+
+const std::vector<MMLTrackParser::TempoEvent>& MMLTrackParser::getTempoEvents() const
+{
+    return parseResult.tempoEvents;
+}
+
+void MMLTrackParser::setCancelFlag(const std::atomic<bool>* flag)
+{
+    cancelFlag = flag;
+}
+
+bool MMLTrackParser::checkCancelled()
+{
+    if (cancelFlag == nullptr || !cancelFlag->load(std::memory_order_relaxed))
+        return false;
+        
+    errorMessage = "Compilation cancelled";
+    return true;
+}
+
+bool MMLTrackParser::parseNote(ParseState& state)
+{
+    MMLCommand& note = addCommand(MMLCommand::Type::Note, tokens[state.position].offset);
+    note.noteName = tokens[state.position++].symbol;
+    
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Sharp))
+    {
+        note.accidental = 1;
+        state.position++;
+    }
+    else if (nextTokenIsAttached(state, MMLLexer::TokenType::Flat))
+    {
+        note.accidental = -1;
+        state.position++;
+    }
+    
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Number))
+    {
+        if (!parseDurationValue(state, note))
+            return false;
+    }
+    
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Dot))
+    {
+        note.isDotted = true;
+        state.position++;
+    }
+    
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Tie))
+    {
+        note.isTied = true;
+        state.position++;
+    }
+    
+    return true;
+}
+
+bool MMLTrackParser::parseRest(ParseState& state)
+{
+    // Skip 'r'
+    MMLCommand& rest = addCommand(MMLCommand::Type::Rest, tokens[state.position++].offset);
+    
+    // Parse note duration
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Number))
+    {
+        if (!parseDurationValue(state, rest))
+            return false;
+    }
+    
+    // Parse dotted note
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Dot))
+    {
+        rest.isDotted = true;
+        state.position++;
+    }
+    
+    return true;
+}
+
+bool MMLTrackParser::parseOctave(ParseState& state)
+{
+    // Skip 'o'
+    const juce::uint32 offset = tokens[state.position++].offset;
+    
+    // Parse octave number
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Number))
+    {
+        const auto& number = tokens[state.position];
+        if (number.value < 0 || number.value > 8) {
+            errorMessage = "Octave out of range (0-8) at position " + formatPosition(number.offset);
+            return false;
+        }
+        addCommand(MMLCommand::Type::SetOctave, offset).value = number.value;
+        state.position++;
+        return true;
+    }
+    
+    errorMessage = "Invalid octave at position " + formatPosition(positionAfterPrevious(state));
+    return false;
+}
+
+bool MMLTrackParser::parseOctaveShift(ParseState& state)
+{
+    const MMLLexer::Token& token = tokens[state.position++];
+    addCommand(token.type == MMLLexer::TokenType::OctaveUp ? MMLCommand::Type::OctaveUp : MMLCommand::Type::OctaveDown,
+               token.offset);
+    return true;
+}
+
+bool MMLTrackParser::parseDuration(ParseState& state)
+{
+    // Skip 'l'
+    const juce::uint32 offset = tokens[state.position++].offset;
+    
+    // Parse note duration
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Number))
+    {
+        MMLCommand& length = addCommand(MMLCommand::Type::SetLength, offset);
+        if (!parseDurationValue(state, length))
+            return false;
+            
+        // Parse dotted note
+        if (nextTokenIsAttached(state, MMLLexer::TokenType::Dot))
+        {
+            length.isDotted = true;
+            state.position++;
+        }
+        
+        return true;
+    }
+    
+    errorMessage = "Invalid duration at position " + formatPosition(positionAfterPrevious(state));
+    return false;
+}
+
+bool MMLTrackParser::parseTempo(ParseState& state)
+{
+    // Skip 't'
+    const juce::uint32 offset = tokens[state.position++].offset;
+    
+    // Parse tempo value
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Number))
+    {
+        const auto& number = tokens[state.position++];
+        
+        // Check tempo range
+        if (number.value >= 20 && number.value <= 300)
+        {
+            addCommand(MMLCommand::Type::Tempo, offset).value = number.value;
+            return true;
+        }
+        
+        errorMessage = "Tempo out of range (20-300) at position " + formatPosition(number.offset);
+        return false;
+    }
+    
+    errorMessage = "Invalid tempo at position " + formatPosition(positionAfterPrevious(state));
+    return false;
+}
+
+bool MMLTrackParser::parseVolume(ParseState& state)
+{
+    // Skip 'v'
+    const juce::uint32 offset = tokens[state.position++].offset;
+    
+    // Parse volume value
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Number))
+    {
+        const auto& number = tokens[state.position++];
+        
+        // Check volume range
+        if (number.value >= 0 && number.value <= 127)
+        {
+            addCommand(MMLCommand::Type::Volume, offset).value = number.value;
+            return true;
+        }
+        
+        errorMessage = "Volume out of range (0-127) at position " + formatPosition(number.offset);
+        return false;
+    }
+    
+    errorMessage = "Invalid volume at position " + formatPosition(positionAfterPrevious(state));
+    return false;
+}
+
+bool MMLTrackParser::parseLoop(ParseState& state)
+{
+    if (static_cast<int>(state.loops.size()) >= MMLProgram::maxRepeatDepth)
+    {
+        errorMessage = "Loops nested too deeply (max " + juce::String(MMLProgram::maxRepeatDepth)
+                     + ") at position " + formatPosition(tokens[state.position].offset);
+        return false;
+    }
+    
+    // Skip '['
+    MMLCommand& repeat = addCommand(MMLCommand::Type::Repeat, tokens[state.position++].offset);
+    repeat.value = 1; // Played once until the matching ']' sets the count
+    
+    // Save loop information
+    MMLLoop loop;
+    loop.startPos = static_cast<int>(commands.size()) - 1;
+    loop.count = 2; // Default is 2 times
+    
+    state.loops.push_back(loop);
+    
+    return true;
+}
+
+bool MMLTrackParser::parseEndLoop(ParseState& state)
+{
+    // Skip ']'
+    const juce::uint32 offset = tokens[state.position++].offset;
+    
+    // Ensure loop stack is not empty
+    if (state.loops.empty())
+    {
+        errorMessage = "Unmatched loop end at position " + formatPosition(offset);
+        return false;
+    }
+    
+    // Parse loop count
+    int count = 2; // Default
+    
+    // If there is a number after '*'
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Star)
+        && state.position + 1 < tokens.size()
+        && tokens[state.position + 1].type == MMLLexer::TokenType::Number
+        && tokens[state.position + 1].offset == tokens[state.position].end())
+    {
+        state.position++;
+        count = tokens[state.position++].value;
+    }
+    // If there is a number directly
+    else if (nextTokenIsAttached(state, MMLLexer::TokenType::Number))
+    {
+        count = tokens[state.position++].value;
+    }
+    
+    // Check loop count range
+    if (count < 1 || count > 100)
+    {
+        errorMessage = "Loop count out of range (1-100) at position " + formatPosition(positionAfterPrevious(state));
+        return false;
+    }
+    
+    // Close the Repeat command over the body parsed since '['
+    MMLLoop& loop = state.loops.back();
+    loop.count = count;
+    
+    MMLCommand& repeat = commands[static_cast<size_t>(loop.startPos)];
+    repeat.value = count;
+    repeat.bodySize = static_cast<int>(commands.size()) - loop.startPos - 1;
+    
+    // Remove from loop stack
+    state.loops.pop_back();
+    
+    return true;
+}
+
+bool MMLTrackParser::parseTuplet(ParseState& state)
+{
+    // Skip '{'
+    MMLCommand& tuplet = addCommand(MMLCommand::Type::Tuplet, tokens[state.position++].offset);
+    tuplet.value = 0; // Length is set by the matching '}'
+    
+    state.tupletStart = static_cast<int>(commands.size()) - 1;
+    
+    return true;
+}
+
+bool MMLTrackParser::parseEndTuplet(ParseState& state)
+{
+    // Skip '}'
+    const juce::uint32 offset = tokens[state.position++].offset;
+    
+    if (state.tupletStart < 0)
+    {
+        errorMessage = "Unmatched tuplet end at position " + formatPosition(offset);
+        return false;
+    }
+    
+    MMLCommand& tuplet = commands[static_cast<size_t>(state.tupletStart)];
+    tuplet.bodySize = static_cast<int>(commands.size()) - state.tupletStart - 1;
+    
+    bool hasNotes = false;
+    for (int i = state.tupletStart + 1; i < static_cast<int>(commands.size()); i++)
+    {
+        const MMLCommand::Type type = commands[static_cast<size_t>(i)].type;
+        hasNotes |= (type == MMLCommand::Type::Note || type == MMLCommand::Type::Rest);
+    }
+    
+    if (!hasNotes)
+    {
+        errorMessage = "Empty tuplet at position " + formatPosition(offset);
+        return false;
+    }
+    
+    // Parse total length shared by the tuplet's notes
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Number))
+    {
+        if (!parseDurationValue(state, tuplet))
+            return false;
+    }
+    
+    if (nextTokenIsAttached(state, MMLLexer::TokenType::Dot))
+    {
+        tuplet.isDotted = true;
+        state.position++;
+    }
+    
+    state.tupletStart = -1;
+    
+    return true;
+}
+
+bool MMLTrackParser::parseDurationValue(ParseState& state, MMLCommand& command)
+{
+    // Store denominator of note duration (0 means the default length)
+    const auto& number = tokens[state.position++];
+    
+    if (number.value > MMLTime::maxLengthDenominator)
+    {
+        errorMessage = "Length out of range (0-" + juce::String(MMLTime::maxLengthDenominator)
+                     + ") at position " + formatPosition(number.offset);
+        return false;
+    }
+    
+    command.value = number.value;
+    return true;
+}
+
+bool MMLTrackParser::skipToken(ParseState& state)
+{
+    // Modifiers and numbers that no command consumed
+    state.position++;
+    return true;
+}
+
+// In MMLLexer::TokenType order, so dispatching a token is a single indexed call
+const MMLTrackParser::TokenRule MMLTrackParser::tokenRules[MMLLexer::numTokenTypes] =
+{
+    { &MMLTrackParser::parseNote,        true,  true  }, // Note
+    { &MMLTrackParser::parseRest,        true,  true  }, // Rest
+    { &MMLTrackParser::parseOctave,      true,  true  }, // Octave
+    { &MMLTrackParser::parseOctaveShift, true,  true  }, // OctaveUp
+    { &MMLTrackParser::parseOctaveShift, true,  true  }, // OctaveDown
+    { &MMLTrackParser::parseDuration,    true,  false }, // Length
+    { &MMLTrackParser::parseTempo,       true,  false }, // Tempo
+    { &MMLTrackParser::parseVolume,      true,  false }, // Volume
+    { &MMLTrackParser::parseLoop,        true,  false }, // LoopBegin
+    { &MMLTrackParser::parseEndLoop,     false, false }, // LoopEnd
+    { &MMLTrackParser::parseTuplet,      true,  false }, // TupletBegin
+    { &MMLTrackParser::parseEndTuplet,   false, true  }, // TupletEnd
+    { &MMLTrackParser::skipToken,        false, true  }, // Number
+    { &MMLTrackParser::skipToken,        false, true  }, // Sharp
+    { &MMLTrackParser::skipToken,        false, true  }, // Flat
+    { &MMLTrackParser::skipToken,        false, true  }, // Dot
+    { &MMLTrackParser::skipToken,        false, true  }, // Tie
+    { &MMLTrackParser::skipToken,        false, true  }  // Star
+};
+
+MMLTrackParser::MMLCommand& MMLTrackParser::addCommand(MMLCommand::Type type, juce::uint32 offset)
+{
+    commands.emplace_back();
+    MMLCommand& command = commands.back();
+    command.type = type;
+    command.offset = offset;
+    return command;
+}
+
+void MMLTrackParser::compileCommands(int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        const MMLCommand& command = commands[static_cast<size_t>(i)];
+        
+        switch (command.type)
+        {
+            case MMLCommand::Type::Note:
+                program.addNote(command.noteName, command.accidental, command.value, command.isDotted, command.isTied);
+                break;
+                
+            case MMLCommand::Type::Rest:
+                program.addRest(command.value, command.isDotted);
+                break;
+                
+            case MMLCommand::Type::SetOctave:
+                program.addOctave(command.value);
+                break;
+                
+            case MMLCommand::Type::OctaveUp:
+                program.addOctaveUp();
+                break;
+                
+            case MMLCommand::Type::OctaveDown:
+                program.addOctaveDown();
+                break;
+                
+            case MMLCommand::Type::SetLength:
+                program.addLength(command.value, command.isDotted);
+                break;
+                
+            case MMLCommand::Type::Tempo:
+                program.addTempo(command.value);
+                break;
+                
+            case MMLCommand::Type::Volume:
+                program.addVolume(command.value);
+                break;
+                
+            case MMLCommand::Type::Repeat:
+            {
+                const int bodyBegin = i + 1;
+                const int bodyEnd = bodyBegin + command.bodySize;
+                
+                if (command.bodySize > 0)
+                {
+                    program.beginRepeat(command.value);
+                    compileCommands(bodyBegin, bodyEnd);
+                    program.endRepeat();
+                }
+                
+                i = bodyEnd - 1;
+                break;
+            }
+            
+            case MMLCommand::Type::Tuplet:
+            {
+                const int bodyBegin = i + 1;
+                const int bodyEnd = bodyBegin + command.bodySize;
+                
+                program.beginTuplet(command.value, command.isDotted);
+                compileCommands(bodyBegin, bodyEnd);
+                program.endTuplet();
+                
+                i = bodyEnd - 1;
+                break;
+            }
+        }
+    }
+}
+
+bool MMLTrackParser::nextTokenIsAttached(const ParseState& state, MMLLexer::TokenType type) const
+{
+    // Modifiers such as accidentals, lengths and dots only apply when they directly follow
+    // the previous token, with no whitespace or ignored characters in between
+    if (state.position == 0 || state.position >= tokens.size())
+        return false;
+        
+    const auto& next = tokens[state.position];
+    return next.type == type && next.offset == tokens[state.position - 1].end();
+}
+
+juce::uint32 MMLTrackParser::positionAfterPrevious(const ParseState& state) const
+{
+    return state.position > 0 ? tokens[state.position - 1].end() : 0;
+}
+
+juce::String MMLTrackParser::formatPosition(juce::uint32 offset) const
+{
+    // Errors report positions in the whole score, not in the track
+    return juce::String(sourceOffset + offset);
+}
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MMLLexer.h"
+#include "MMLProgram.h"
+#include "MMLInterpreter.h"
+#include "MMLTime.h"
+#include "MMLMidiEvent.h"
+
+/**
+ * MMLTrackParser - Parses and expands one track (voice) of an MML score
+ *
+ * Turns the text of a single track into timed notes and tempo changes. The
+ * result of the last successful parse is kept, so an edited version of the
+ * same track can be reparsed incrementally. A track parser is used from one
+ * thread at a time, but different tracks can be parsed on different threads.
+ */
+class MMLTrackParser
+{
+public:
+    struct TempoEvent {
+        juce::int64 tick;
+        int tempo;
+    };
+
+    /** Tracks that expand to more notes than this are not expanded (see isExpanded()). */
+    static constexpr size_t maxExpandedNotes = 1000000;
+    
+    MMLTrackParser();
+    ~MMLTrackParser();
+    
+    /**
+     * Parses the text of one track.
+     * @param trackText The UTF-8 encoded text of the track (may be empty).
+     * @param sourceOffset Byte offset of the track in the whole score, used in error positions.
+     * @return True if parsing succeeded, false otherwise.
+     */
+    bool parse(std::string_view trackText, juce::uint32 sourceOffset);
+    
+    /**
+     * Parses an edited version of the previously parsed track, reusing as much of the
+     * last successful parse as possible. Work restarts at the last checkpoint before
+     * the first changed byte and stops once the musical state matches the previous
+     * parse again; everything after that is shifted and kept. The result is the same
+     * as parse(), which is used instead when there is no previous parse to reuse.
+     * @param trackText The edited text of the track.
+     * @param sourceOffset Byte offset of the track in the whole score, used in error positions.
+     * @return True if parsing succeeded, false otherwise.
+     */
+    bool reparse(std::string_view trackText, juce::uint32 sourceOffset);
+    
+    /**
+     * Checks whether the last successful parse expanded the track into notes. Tracks that
+     * would expand to more than maxExpandedNotes notes are only compiled to bytecode, to be
+     * played with MMLEventStream; generateEvents() and getTempoEvents() return nothing for them.
+     * @return True if the track was expanded.
+     */
+    bool isExpanded() const;
+    
+    /**
+     * Checks whether reparse() would have nothing to do for the given text.
+     * @param trackText Text of the track.
+     * @return True if the text is the text of the last successful parse.
+     */
+    bool isUpToDate(std::string_view trackText) const;
+    
+    /**
+     * Generates the parsed track as MIDI events on the tick timeline, in tick order.
+     * At the same tick, a note-off comes before a note-on. The events are produced
+     * in order in a single pass, without sorting.
+     * @param events Receives the events (cleared first).
+     * @param channel MIDI channel of the events (1-16).
+     */
+    void generateEvents(std::vector<MMLMidiEvent>& events, int channel);
+    
+    /**
+     * Gets the tempo changes of the last successful parse, in playback order.
+     * @return Tempo changes.
+     */
+    const std::vector<TempoEvent>& getTempoEvents() const;
+    
+    /**
+     * Gets the error message after parsing.
+     * @return Error message string.
+     */
+    juce::String getError() const;
+    
+    /**
+     * Gets the compiled bytecode of the last successful parse.
+     * @return Compiled program.
+     */
+    const MMLProgram& getProgram() const;
+    
+    /**
+     * Sets a flag that another thread can raise to abandon a parse in progress.
+     * A cancelled parse returns false with a "Compilation cancelled" error.
+     * @param flag Flag to poll, or nullptr to disable cancellation.
+     */
+    void setCancelFlag(const std::atomic<bool>* flag);
+
+private:
+    /** Number of tokens or notes processed between polls of the cancel flag. */
+    static constexpr int cancelCheckInterval = 4096;
+    
+    /** Minimum number of commands between checkpoints (about a bar or two of typical MML). */
+    static constexpr int checkpointInterval = 64;
+
+    /**
+     * The expanded notes of a track, in start order, as parallel arrays: about 15 bytes a
+     * note, and passes over the whole track (such as moving it in time) run over contiguous
+     * data. Pitches are resolved when the notes are built. Rests produce no events, so
+     * they are not stored.
+     */
+    struct NoteArrays {
+        enum Flags : juce::uint8 {
+            tied = 1 // No note-off: the next note continues it
+        };
+        size_t size() const { return startTicks.size(); }
+        void clear();
+        void add(juce::int64 startTick, juce::int32 lengthTicks, juce::uint8 pitch, juce::uint8 velocity, juce::uint8 noteFlags);
+        void truncate(size_t numNotes);
+        void appendFrom(const NoteArrays& source, size_t first);
+        void shiftFrom(size_t first, juce::int64 ticks);
+        std::vector<juce::int64> startTicks;
+        std::vector<juce::int32> lengthTicks;
+        std::vector<juce::uint8> pitches;    // MIDI note numbers
+        std::vector<juce::uint8> velocities;
+        std::vector<juce::uint8> flags;      // Flags bits
+    };
+    /**
+     * Intermediate representation of one MML command.
+     * Loops and tuplets are stored as a Repeat / Tuplet command followed by its
+     * already-parsed body, so the command list is a tree flattened in pre-order.
+     */
+    struct MMLCommand {
+        enum class Type : juce::uint8 {
+            Note, Rest, SetOctave, OctaveUp, OctaveDown, SetLength, Tempo, Volume, Repeat, Tuplet
+        };
+        MMLCommand();
+        Type type;
+        char noteName;
+        int accidental;
+        bool isDotted;
+        bool isTied;
+        int value;        // Octave, length denominator (0 = default), tempo, volume or repeat count
+        int bodySize;     // Repeat / Tuplet only: number of commands in the body
+        juce::uint32 offset; // Byte offset of the command in the source
+    };
+    struct MMLLoop {
+        MMLLoop();
+        int startPos; // Index of the Repeat command that opened the loop
+        int count;
+    };
+    struct ParseResult {
+        ParseResult();
+        void clear();
+        NoteArrays notes;
+        std::vector<TempoEvent> tempoEvents; // Every tempo command in playback order
+        juce::int64 totalDuration; // In ticks
+    };
+    /**
+     * A top-level command (outside any loop or tuplet) where parsing can restart,
+     * with how much of each pass's output comes before it.
+     */
+    struct Checkpoint {
+        Checkpoint();
+        int tokenIndex;
+        int commandIndex;
+        size_t programOffset;
+        size_t noteIndex;
+        size_t tempoEventIndex;
+        MMLInterpreter::State state; // Musical state on reaching the checkpoint
+    };
+    /**
+     * Output of the previous parse from the restart checkpoint onwards, kept while the
+     * edited region is rebuilt so that the unchanged part can be spliced back in.
+     */
+    struct ReparseTail {
+        ReparseTail();
+        void clear();
+        Checkpoint start;                       // Restart checkpoint (same position in both parses)
+        std::vector<MMLLexer::Token> tokens;
+        std::vector<MMLCommand> commands;
+        std::vector<juce::uint8> program;
+        NoteArrays notes;
+        std::vector<TempoEvent> tempoEvents;
+        std::vector<Checkpoint> checkpoints;    // Checkpoints after the restart checkpoint
+        juce::int64 totalDuration;
+        juce::int64 byteShift;                  // New minus old source offset of unchanged text
+        int firstKeptToken;                     // Old index of the first token reused as is
+        int tokenShift;                         // New minus old index of reused tokens
+        int firstKeptCheckpoint;                // Index in checkpoints of the first reused checkpoint
+    };
+    struct ParseState {
+        ParseState();
+        size_t position; // Index into the token stream
+        int tupletStart; // Index of the open Tuplet command, or -1
+        std::vector<MMLLoop> loops;
+    };
+    /** A note-off waiting in generateEvents() for the stream to reach its tick. */
+    struct PendingNoteOff {
+        juce::int64 tick;
+        juce::uint32 noteIndex; // Breaks ties, so note-offs at one tick keep their note order
+        juce::uint8 midiNote;
+    };
+    /** How parsing treats a token that starts a command, indexed by MMLLexer::TokenType. */
+    struct TokenRule {
+        bool (MMLTrackParser::*parse)(ParseState& state);
+        bool startsCommand;   // Begins a command a checkpoint can be placed before
+        bool allowedInTuplet; // Tuplets are measured by their notes, so only those and octave changes fit
+    };
+    static const TokenRule tokenRules[MMLLexer::numTokenTypes];
+
+    bool parseNote(ParseState& state);
+    bool parseRest(ParseState& state);
+    bool parseOctave(ParseState& state);
+    bool parseOctaveShift(ParseState& state);
+    bool parseDuration(ParseState& state);
+    bool parseTempo(ParseState& state);
+    bool parseVolume(ParseState& state);
+    bool parseLoop(ParseState& state);
+    bool parseEndLoop(ParseState& state);
+    bool parseTuplet(ParseState& state);
+    bool parseEndTuplet(ParseState& state);
+    bool parseDurationValue(ParseState& state, MMLCommand& command);
+    bool skipToken(ParseState& state);
+    MMLCommand& addCommand(MMLCommand::Type type, juce::uint32 offset);
+    void compileCommands(int begin, int end);
+    bool buildFrom(int startCheckpoint, std::string_view trackText);
+    bool buildCommands(int startCheckpoint);
+    void buildProgram(int startCheckpoint);
+    bool buildNotes(int startCheckpoint);
+    bool reachesKeptCheckpoint(int position, size_t& nextKept) const;
+    void keepCommandsFrom(size_t keptCheckpoint);
+    void keepNotesFrom(int checkpointIndex, juce::int64 tickShift);
+    static bool getTickShift(const MMLInterpreter::State& current, const MMLInterpreter::State& previous, juce::int64& tickShift);
+    bool nextTokenIsAttached(const ParseState& state, MMLLexer::TokenType type) const;
+    juce::uint32 positionAfterPrevious(const ParseState& state) const;
+    juce::String formatPosition(juce::uint32 offset) const;
+    bool checkCancelled();
+
+    juce::String errorMessage;
+    std::vector<MMLLexer::Token> tokens;
+    std::vector<MMLCommand> commands;
+    MMLProgram program;
+    ParseResult parseResult;
+    std::vector<Checkpoint> checkpoints;
+    ReparseTail reparseTail;
+    ParseState parseState;
+    std::vector<PendingNoteOff> pendingNoteOffs; // Min-heap, kept to reuse its storage
+    std::string source;        // Text of the last successful parse
+    juce::uint32 sourceOffset; // Offset of the track in the score
+    bool canReparse;
+    bool expanded;
+    const std::atomic<bool>* cancelFlag;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace MMLPlugin {
+
+/**
+ * MMLCacheAlignedAllocator - Standard allocator that starts every block on a cache line
+ *
+ * Used for arrays the audio thread scans linearly, so the first element never
+ * straddles two lines and neighbouring instances do not share a line.
+ */
+template <typename T>
+struct MMLCacheAlignedAllocator
+{
+    using value_type = T;
+
+    static constexpr std::size_t alignment = 64;
+
+    MMLCacheAlignedAllocator() noexcept = default;
+
+    template <typename U>
+    MMLCacheAlignedAllocator(const MMLCacheAlignedAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+    }
+
+    void deallocate(T* p, std::size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+
+    template <typename U>
+    bool operator==(const MMLCacheAlignedAllocator<U>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const MMLCacheAlignedAllocator<U>&) const noexcept { return false; }
+};
+
+} // namespace MMLPlugin
@@ -0,0 +1,24 @@
+#include "MMLCompiledSequence.h"
+
+namespace MMLPlugin {
+
+void MMLCompiledSequence::resolveSamplePositions(double newSampleRate)
+{
+    sampleRate = newSampleRate;
+    const auto& events = score->events;
+    samplePositions.resize(events.size());
+
+    for (size_t i = 0; i < events.size(); ++i)
+        samplePositions[i] = score->tempoMap.tickToSample(events[i].tick, sampleRate);
+}
+
+bool MMLCompiledScore::buildSeekTable(const std::atomic<bool>* cancelFlag)
+{
+    // Seek positions are kept in ticks, so any sample rate will do for the walk
+    MMLEventStream stream;
+    stream.setTracks(programs.data(), static_cast<int>(programs.size()), 44100.0);
+
+    return stream.buildSeekTable(seekTable, cancelFlag);
+}
+
+} // namespace MMLPlugin
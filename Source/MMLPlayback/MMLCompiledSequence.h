@@ -0,0 +1,78 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <memory>
+#include <vector>
+#include "../MMLParser/MMLEventStream.h"
+#include "../MMLParser/MMLMidiEvent.h"
+#include "../MMLParser/MMLProgram.h"
+#include "../MMLParser/MMLTempoMap.h"
+#include "MMLCacheAlignedAllocator.h"
+
+namespace MMLPlugin {
+
+/**
+ * MMLCompiledScore - Everything compiled from one MML score that does not depend on the host
+ *
+ * Immutable once built, so a single copy is shared by every plugin instance playing the
+ * same score (see MMLCompileCache), and by every sequence published from it.
+ *
+ * A score too long to expand is streamed instead: it carries the compiled track
+ * programs, which the audio thread runs with an MMLEventStream, and no events.
+ * Programs are shared per track, so a track that several scores have in common
+ * is held once (see MMLCompileCache::shareProgram()).
+ */
+struct MMLCompiledScore
+{
+    using EventArray = std::vector<MMLMidiEvent, MMLCacheAlignedAllocator<MMLMidiEvent>>;
+
+    /**
+     * Records the seek positions of a streamed score (walks the whole score once).
+     * @param cancelFlag Flag to poll to abandon the walk, or nullptr.
+     * @return False if cancelled.
+     */
+    bool buildSeekTable(const std::atomic<bool>* cancelFlag);
+
+    /** Checks whether the score is played from its track programs rather than from events. */
+    bool isStreamed() const { return ! programs.empty(); }
+
+    /** Checks whether there is anything to play. */
+    bool isEmpty() const { return events.empty() && (! isStreamed() || seekTable.getNumEvents() == 0); }
+
+    /** Gets the number of events (for a streamed score, as far as its seek table reaches). */
+    juce::int64 getNumEvents() const { return isStreamed() ? seekTable.getNumEvents() : static_cast<juce::int64>(events.size()); }
+
+    EventArray events;                    // Playback order; what the audio thread reads unless streamed
+    MMLTempoMap tempoMap;                 // Converts event ticks to time
+    juce::MidiMessageSequence sequence;   // Same events in seconds, for the message thread only
+    std::vector<std::shared_ptr<const MMLProgram>> programs; // Streamed scores only: one program per track
+    MMLEventStream::SeekTable seekTable;  // Streamed scores only: positions to seek from
+};
+
+/**
+ * MMLCompiledSequence - Playback data produced by compiling MML text
+ *
+ * Built off the audio thread and handed over through MMLSequenceExchange.
+ * Once published it is immutable, so the audio thread can read it without locking.
+ *
+ * Event times are resolved to absolute sample positions for one sample rate
+ * before publishing; a sample rate change publishes a re-resolved copy. Only the
+ * positions belong to the sequence: the compiled score itself is shared.
+ */
+struct MMLCompiledSequence
+{
+    using SamplePositionArray = std::vector<juce::int64, MMLCacheAlignedAllocator<juce::int64>>;
+
+    /**
+     * Converts every event's tick to a sample position through the tempo map.
+     * @param newSampleRate Sample rate the positions are resolved for.
+     */
+    void resolveSamplePositions(double newSampleRate);
+
+    std::shared_ptr<const MMLCompiledScore> score; // Never null once published
+    SamplePositionArray samplePositions;  // samplePositions[i] is the timeline sample of score->events[i]
+    double sampleRate = 0.0;              // Sample rate samplePositions were resolved for
+    juce::uint64 serial = 0;              // Assigned on publish, unique for each published sequence
+};
+
+} // namespace MMLPlugin
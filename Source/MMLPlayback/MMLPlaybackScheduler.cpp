@@ -0,0 +1,218 @@
+#include "MMLPlaybackScheduler.h"
+#include <algorithm>
+#include "MMLRealtimeAuditLockCheck.h"
+
+namespace MMLPlugin {
+
+MMLPlaybackScheduler::MMLPlaybackScheduler()
+{
+    reset();
+}
+
+void MMLPlaybackScheduler::reset()
+{
+    playingSerial = 0;
+    nextEventIndex = 0;
+    needsSeek = false;
+    hostWasPlaying = false;
+    expectedHostPosition = 0;
+    isPreviewing = false;
+    previewPosition = 0;
+
+    std::fill(std::begin(heldNoteCounts), std::end(heldNoteCounts), juce::uint8(0));
+    numHeldNotes = 0;
+}
+
+void MMLPlaybackScheduler::startPreview()
+{
+    isPreviewing = true;
+    previewPosition = 0;
+    needsSeek = true;
+}
+
+void MMLPlaybackScheduler::process(const MMLCompiledSequence& compiled, const Transport& transport,
+                                   int numSamples, juce::MidiBuffer& midiMessages)
+{
+    // A newly published sequence replaces whatever was playing
+    if (compiled.serial != playingSerial)
+    {
+        playingSerial = compiled.serial;
+        needsSeek = true;
+
+        if (compiled.score->isStreamed())
+            stream.setTracks(compiled.score->programs.data(), static_cast<int>(compiled.score->programs.size()), compiled.sampleRate);
+    }
+
+    if (transport.isPlaying)
+    {
+        // The host timeline takes over from any preview
+        isPreviewing = false;
+
+        // Any jump in the host position (locate, cycle wrap) re-arms the cursor
+        if (needsSeek || ! hostWasPlaying || transport.samplePosition != expectedHostPosition)
+            seek(compiled, transport.samplePosition, midiMessages, 0);
+
+        const juce::int64 blockStart = transport.samplePosition;
+        const juce::int64 blockEnd = blockStart + numSamples;
+
+        if (transport.isLooping && transport.loopStart < transport.loopEnd
+            && blockStart < transport.loopEnd && blockEnd > transport.loopEnd)
+        {
+            // The cycle wraps inside this block: play up to the loop end, then carry on from the loop start
+            const int samplesBeforeWrap = static_cast<int>(transport.loopEnd - blockStart);
+            const int samplesAfterWrap = numSamples - samplesBeforeWrap;
+
+            renderEvents(compiled, blockStart, 0, samplesBeforeWrap, midiMessages);
+            seek(compiled, transport.loopStart, midiMessages, samplesBeforeWrap);
+            renderEvents(compiled, transport.loopStart, samplesBeforeWrap, samplesAfterWrap, midiMessages);
+
+            expectedHostPosition = transport.loopStart + samplesAfterWrap;
+        }
+        else
+        {
+            renderEvents(compiled, blockStart, 0, numSamples, midiMessages);
+            expectedHostPosition = blockEnd;
+        }
+    }
+    else
+    {
+        if (hostWasPlaying)
+            releaseHeldNotes(midiMessages, 0);
+
+        if (isPreviewing)
+        {
+            if (needsSeek)
+                seek(compiled, previewPosition, midiMessages, 0);
+
+            renderEvents(compiled, previewPosition, 0, numSamples, midiMessages);
+            previewPosition += numSamples;
+
+            if (isAtEnd(compiled))
+                isPreviewing = false;
+        }
+    }
+
+    hostWasPlaying = transport.isPlaying;
+}
+
+void MMLPlaybackScheduler::seek(const MMLCompiledSequence& compiled, juce::int64 samplePosition,
+                                juce::MidiBuffer& midiMessages, int sampleOffset)
+{
+    // Notes started before the jump would never see their note-off
+    releaseHeldNotes(midiMessages, sampleOffset);
+
+    if (compiled.score->isStreamed())
+    {
+        stream.seek(compiled.score->seekTable, samplePosition);
+    }
+    else
+    {
+        // Events are sorted by tick, so their sample positions are sorted too
+        const auto& positions = compiled.samplePositions;
+        nextEventIndex = static_cast<size_t>(std::lower_bound(positions.begin(), positions.end(), samplePosition) - positions.begin());
+    }
+
+    needsSeek = false;
+}
+
+void MMLPlaybackScheduler::renderEvents(const MMLCompiledSequence& compiled, juce::int64 timelineStart,
+                                        int sampleOffset, int numSamples, juce::MidiBuffer& midiMessages)
+{
+    if (compiled.score->isStreamed())
+    {
+        renderStreamedEvents(timelineStart, sampleOffset, numSamples, midiMessages);
+        return;
+    }
+
+    const juce::int64 timelineEnd = timelineStart + numSamples;
+    const MMLMidiEvent* events = compiled.score->events.data();
+    const juce::int64* positions = compiled.samplePositions.data();
+    const size_t numEvents = compiled.samplePositions.size();
+
+    while (nextEventIndex < numEvents)
+    {
+        const MMLMidiEvent& event = events[nextEventIndex];
+        const juce::int64 eventSample = positions[nextEventIndex];
+
+        if (eventSample >= timelineEnd)
+            break;
+
+        writeEvent(event, eventSample, timelineStart, sampleOffset, midiMessages);
+        nextEventIndex++;
+    }
+}
+
+void MMLPlaybackScheduler::renderStreamedEvents(juce::int64 timelineStart, int sampleOffset, int numSamples,
+                                                juce::MidiBuffer& midiMessages)
+{
+    const juce::int64 timelineEnd = timelineStart + numSamples;
+
+    // Events are produced as they are reached, so the stream only holds the loop counters of each track
+    while (! stream.isFinished() && stream.getSamplePosition() < timelineEnd)
+    {
+        writeEvent(stream.getEvent(), stream.getSamplePosition(), timelineStart, sampleOffset, midiMessages);
+        stream.advance();
+    }
+}
+
+bool MMLPlaybackScheduler::isAtEnd(const MMLCompiledSequence& compiled) const
+{
+    return compiled.score->isStreamed() ? stream.isFinished() : nextEventIndex >= compiled.score->events.size();
+}
+
+void MMLPlaybackScheduler::writeEvent(const MMLMidiEvent& event, juce::int64 eventSample, juce::int64 timelineStart,
+                                      int sampleOffset, juce::MidiBuffer& midiMessages)
+{
+    // Note-offs for notes that began before a seek were already sent (or never started)
+    if (trackHeldNote(event))
+    {
+        const int position = sampleOffset + static_cast<int>(juce::jmax(juce::int64(0), eventSample - timelineStart));
+        midiMessages.addEvent(event.data, static_cast<int>(sizeof(event.data)), position);
+    }
+}
+
+bool MMLPlaybackScheduler::trackHeldNote(const MMLMidiEvent& event)
+{
+    const bool isNoteOn = event.isNoteOn();
+
+    if (! isNoteOn && ! event.isNoteOff())
+        return true;
+
+    const int index = (event.getChannel() - 1) * 128 + event.getNoteNumber();
+
+    if (isNoteOn)
+    {
+        if (heldNoteCounts[index] < 255)
+        {
+            heldNoteCounts[index]++;
+            numHeldNotes++;
+        }
+    }
+    else
+    {
+        if (heldNoteCounts[index] == 0)
+            return false;
+
+        heldNoteCounts[index]--;
+        numHeldNotes--;
+    }
+
+    return true;
+}
+
+void MMLPlaybackScheduler::releaseHeldNotes(juce::MidiBuffer& midiMessages, int sampleOffset)
+{
+    for (int index = 0; numHeldNotes > 0 && index < numChannels * 128; ++index)
+    {
+        // One note-off per outstanding note-on, so overlapping notes of the same pitch all end
+        while (heldNoteCounts[index] > 0)
+        {
+            const juce::uint8 noteOff[] = { static_cast<juce::uint8>(0x80 | (index / 128)), static_cast<juce::uint8>(index % 128), 0 };
+            midiMessages.addEvent(noteOff, static_cast<int>(sizeof(noteOff)), sampleOffset);
+            heldNoteCounts[index]--;
+            numHeldNotes--;
+        }
+    }
+}
+
+} // namespace MMLPlugin
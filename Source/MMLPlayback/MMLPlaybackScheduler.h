@@ -0,0 +1,94 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "MMLCompiledSequence.h"
+
+namespace MMLPlugin {
+
+/**
+ * MMLPlaybackScheduler - Places sequence events at exact sample offsets in each block
+ *
+ * While the host transport is running, the sequence follows the host timeline:
+ * sequence time zero is host sample zero, and every event is written at the
+ * offset of its own sample position inside the block. Because timing only comes
+ * from the sample positions the host reports, offline bounces that run faster
+ * than real time stay exact.
+ *
+ * While the transport is stopped, a preview (started with startPreview()) runs
+ * from a free-running sample counter that advances by each block's length.
+ *
+ * Whenever the position jumps (a locate, a cycle wrap reported by the host, or a
+ * cycle end falling inside a block), the cursor is moved with a binary search over
+ * the event timeline and every note still held gets its note-off.
+ *
+ * Streamed sequences are played with an MMLEventStream instead of the event
+ * array, and seek through their seek table; the timing rules are the same.
+ *
+ * Threading: audio thread only.
+ */
+class MMLPlaybackScheduler
+{
+public:
+    /** Transport state for one block, as reported by the host. */
+    struct Transport
+    {
+        bool isPlaying = false;
+        juce::int64 samplePosition = 0; // Host timeline position of the block's first sample
+
+        bool isLooping = false;
+        juce::int64 loopStart = 0;      // Cycle region in host timeline samples
+        juce::int64 loopEnd = 0;
+    };
+
+    MMLPlaybackScheduler();
+
+    /** Stops playback and forgets the current sequence. */
+    void reset();
+
+    /** Starts playing the sequence from its beginning while the host transport is stopped. */
+    void startPreview();
+
+    /**
+     * Writes the events that fall inside one block.
+     * @param compiled Sequence to play, resolved for the current sample rate;
+     *                 a different serial restarts playback state.
+     * @param transport Host transport state for this block.
+     * @param numSamples Length of the block in samples.
+     * @param midiMessages Receives the events at their sample offsets.
+     */
+    void process(const MMLCompiledSequence& compiled, const Transport& transport,
+                 int numSamples, juce::MidiBuffer& midiMessages);
+
+private:
+    static constexpr int numChannels = 16;
+
+    void seek(const MMLCompiledSequence& compiled, juce::int64 samplePosition,
+              juce::MidiBuffer& midiMessages, int sampleOffset);
+    void renderEvents(const MMLCompiledSequence& compiled, juce::int64 timelineStart,
+                      int sampleOffset, int numSamples, juce::MidiBuffer& midiMessages);
+    void renderStreamedEvents(juce::int64 timelineStart, int sampleOffset, int numSamples,
+                              juce::MidiBuffer& midiMessages);
+    bool isAtEnd(const MMLCompiledSequence& compiled) const;
+    bool trackHeldNote(const MMLMidiEvent& event);
+    void writeEvent(const MMLMidiEvent& event, juce::int64 eventSample, juce::int64 timelineStart,
+                    int sampleOffset, juce::MidiBuffer& midiMessages);
+    void releaseHeldNotes(juce::MidiBuffer& midiMessages, int sampleOffset);
+
+    juce::uint64 playingSerial;
+    size_t nextEventIndex;
+    MMLEventStream stream; // Cursor into a streamed sequence
+    bool needsSeek;
+
+    bool hostWasPlaying;
+    juce::int64 expectedHostPosition; // Where the next block starts if the host keeps playing
+
+    bool isPreviewing;
+    juce::int64 previewPosition;
+
+    juce::uint8 heldNoteCounts[numChannels * 128]; // Outstanding note-ons per channel and note
+    int numHeldNotes;
+
+    JUCE_DECLARE_NON_COPYABLE (MMLPlaybackScheduler)
+};
+
+} // namespace MMLPlugin
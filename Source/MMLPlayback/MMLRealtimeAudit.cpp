@@ -0,0 +1,172 @@
+#include "MMLRealtimeAudit.h"
+
+#if MML_RT_AUDIT
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if MML_RT_AUDIT_HOOKS_MUTEXES
+ #include <dlfcn.h>
+ #include <pthread.h>
+#endif
+
+namespace MMLPlugin {
+
+namespace
+{
+    // Plain thread_local flag: readable from inside operator new without allocating
+    thread_local int realtimeDepth = 0;
+
+    std::atomic<juce::uint64> allocationCount { 0 };
+    std::atomic<juce::uint64> lockCount { 0 };
+
+    juce::uint64 getViolationCount() noexcept
+    {
+        return allocationCount.load(std::memory_order_relaxed) + lockCount.load(std::memory_order_relaxed);
+    }
+}
+
+MMLRealtimeAudit::RealtimeSection::RealtimeSection() noexcept
+    : violationsAtStart(getViolationCount())
+{
+    ++realtimeDepth;
+}
+
+MMLRealtimeAudit::RealtimeSection::~RealtimeSection() noexcept
+{
+    --realtimeDepth;
+
+    // Asserting allocates (the assertion is logged), so only do it once the section has ended
+    if (realtimeDepth == 0 && getViolationCount() != violationsAtStart)
+        jassertfalse;
+}
+
+juce::uint64 MMLRealtimeAudit::getAllocationCount() noexcept
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+juce::uint64 MMLRealtimeAudit::getLockCount() noexcept
+{
+    return lockCount.load(std::memory_order_relaxed);
+}
+
+void MMLRealtimeAudit::reportAllocation() noexcept
+{
+    if (realtimeDepth > 0)
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MMLRealtimeAudit::reportLock() noexcept
+{
+    if (realtimeDepth > 0)
+        lockCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace MMLPlugin
+
+//==============================================================================
+// Global allocation hooks (audit build only)
+namespace
+{
+    void* auditedAllocate(std::size_t size)
+    {
+        MMLPlugin::MMLRealtimeAudit::reportAllocation();
+
+        if (void* p = std::malloc(size == 0 ? 1 : size))
+            return p;
+
+        throw std::bad_alloc();
+    }
+
+    void* auditedAllocateAligned(std::size_t size, std::align_val_t alignment)
+    {
+        MMLPlugin::MMLRealtimeAudit::reportAllocation();
+
+        const auto align = static_cast<std::size_t>(alignment);
+        const std::size_t roundedSize = ((size == 0 ? 1 : size) + align - 1) / align * align;
+
+       #if JUCE_WINDOWS
+        void* p = _aligned_malloc(roundedSize, align);
+       #else
+        void* p = std::aligned_alloc(align, roundedSize);
+       #endif
+
+        if (p == nullptr)
+            throw std::bad_alloc();
+
+        return p;
+    }
+
+    void auditedFree(void* p) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        MMLPlugin::MMLRealtimeAudit::reportAllocation();
+        std::free(p);
+    }
+
+    void auditedFreeAligned(void* p) noexcept
+    {
+        if (p == nullptr)
+            return;
+
+        MMLPlugin::MMLRealtimeAudit::reportAllocation();
+
+       #if JUCE_WINDOWS
+        _aligned_free(p);
+       #else
+        std::free(p);
+       #endif
+    }
+}
+
+void* operator new(std::size_t size)                                    { return auditedAllocate(size); }
+void* operator new[](std::size_t size)                                  { return auditedAllocate(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept    { try { return auditedAllocate(size); } catch (...) { return nullptr; } }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept  { try { return auditedAllocate(size); } catch (...) { return nullptr; } }
+void* operator new(std::size_t size, std::align_val_t alignment)        { return auditedAllocateAligned(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment)      { return auditedAllocateAligned(size, alignment); }
+
+void operator delete(void* p) noexcept                                  { auditedFree(p); }
+void operator delete[](void* p) noexcept                                { auditedFree(p); }
+void operator delete(void* p, std::size_t) noexcept                     { auditedFree(p); }
+void operator delete[](void* p, std::size_t) noexcept                   { auditedFree(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept           { auditedFree(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept         { auditedFree(p); }
+void operator delete(void* p, std::align_val_t) noexcept                { auditedFreeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept              { auditedFreeAligned(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept   { auditedFreeAligned(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { auditedFreeAligned(p); }
+
+//==============================================================================
+// Mutex hook (audit build on POSIX only). Plugins are built with hidden symbol
+// visibility, so this replaces pthread_mutex_lock for every caller inside the plugin
+// binary, including JUCE's CriticalSection and std::mutex, but not the host's own locks.
+#if MML_RT_AUDIT_HOOKS_MUTEXES
+namespace
+{
+    using MutexLockFunction = int (*) (pthread_mutex_t*);
+    std::atomic<MutexLockFunction> realMutexLock { nullptr };
+}
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    MMLPlugin::MMLRealtimeAudit::reportLock();
+
+    // Resolved on first use, before any real-time section can exist; a racing resolve stores the same value
+    MutexLockFunction lock = realMutexLock.load(std::memory_order_relaxed);
+
+    if (lock == nullptr)
+    {
+        lock = reinterpret_cast<MutexLockFunction>(dlsym(RTLD_NEXT, "pthread_mutex_lock"));
+        realMutexLock.store(lock, std::memory_order_relaxed);
+    }
+
+    return lock(mutex);
+}
+#endif
+
+#endif // MML_RT_AUDIT
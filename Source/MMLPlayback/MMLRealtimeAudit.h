@@ -0,0 +1,101 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+/**
+ * Set MML_RT_AUDIT=1 in the project's preprocessor definitions to build the
+ * real-time audit mode. It is off by default and costs nothing when off.
+ */
+#ifndef MML_RT_AUDIT
+ #define MML_RT_AUDIT 0
+#endif
+
+/** On POSIX the audit build also hooks pthread_mutex_lock, so every mutex the plugin takes is seen. */
+#if MML_RT_AUDIT && ! JUCE_WINDOWS
+ #define MML_RT_AUDIT_HOOKS_MUTEXES 1
+#else
+ #define MML_RT_AUDIT_HOOKS_MUTEXES 0
+#endif
+
+namespace MMLPlugin {
+
+/**
+ * MMLRealtimeAudit - Detects real-time violations on the audio thread
+ *
+ * In the audit build, the global operator new and delete are replaced, and
+ * every heap allocation or free made while a RealtimeSection is active on the
+ * calling thread is counted. Mutex locks are counted the same way. When a
+ * section ends having seen a violation, it asserts, so a regression stops a
+ * debug session at the block that caused it.
+ *
+ * On POSIX, pthread_mutex_lock is replaced within the plugin binary, which
+ * covers juce::CriticalSection, std::mutex and any other pthread mutex. A
+ * Windows CRITICAL_SECTION cannot be hooked, so on Windows only locks taken
+ * through AuditedScopedLock are counted. Files whose locks can be reached from
+ * the audio thread include MMLRealtimeAuditLockCheck.h, which makes a plain
+ * juce::ScopedLock fail to compile in the audit build.
+ */
+class MMLRealtimeAudit
+{
+public:
+    /** Marks the calling thread as real-time for the lifetime of the object (audio callback scope). */
+    class RealtimeSection
+    {
+    public:
+       #if MML_RT_AUDIT
+        RealtimeSection() noexcept;
+        ~RealtimeSection() noexcept;
+       #else
+        RealtimeSection() noexcept {}
+       #endif
+
+    private:
+       #if MML_RT_AUDIT
+        juce::uint64 violationsAtStart;
+       #endif
+
+        JUCE_DECLARE_NON_COPYABLE (RealtimeSection)
+    };
+
+    /** A juce::ScopedLock that counts as a violation when taken inside a RealtimeSection. */
+    class AuditedScopedLock
+    {
+    public:
+        explicit AuditedScopedLock(const juce::CriticalSection& lockToTake) noexcept
+            : lock(lockToTake)
+        {
+           #if ! MML_RT_AUDIT_HOOKS_MUTEXES
+            reportLock();  // Otherwise the pthread_mutex_lock hook counts it
+           #endif
+            lock.enter();
+        }
+
+        ~AuditedScopedLock() noexcept { lock.exit(); }
+
+    private:
+        const juce::CriticalSection& lock;
+
+        JUCE_DECLARE_NON_COPYABLE (AuditedScopedLock)
+    };
+
+    /** Total allocations and frees seen inside real-time sections (0 unless audit is enabled). */
+    static juce::uint64 getAllocationCount() noexcept;
+
+    /** Total locks taken inside real-time sections (0 unless audit is enabled). */
+    static juce::uint64 getLockCount() noexcept;
+
+    /** Records an allocation or free if the calling thread is in a real-time section. */
+    static void reportAllocation() noexcept;
+
+    /** Records a lock acquisition if the calling thread is in a real-time section. */
+    static void reportLock() noexcept;
+};
+
+#if ! MML_RT_AUDIT
+inline juce::uint64 MMLRealtimeAudit::getAllocationCount() noexcept { return 0; }
+inline juce::uint64 MMLRealtimeAudit::getLockCount() noexcept { return 0; }
+inline void MMLRealtimeAudit::reportAllocation() noexcept {}
+inline void MMLRealtimeAudit::reportLock() noexcept {}
+#endif
+
+} // namespace MMLPlugin
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "MMLRealtimeAudit.h"
+
+/**
+ * Included after all other headers by files whose locks can be reached from the
+ * audio thread. In the audit build a plain juce::ScopedLock no longer compiles
+ * there, because on Windows the audit could not see it; use
+ * MMLRealtimeAudit::AuditedScopedLock instead.
+ */
+#if MML_RT_AUDIT
+ #define ScopedLock ScopedLock_is_not_seen_by_the_realtime_audit_use_AuditedScopedLock
+#endif
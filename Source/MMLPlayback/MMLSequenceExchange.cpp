@@ -0,0 +1,62 @@
+#include "MMLSequenceExchange.h"
+
+namespace MMLPlugin {
+
+MMLSequenceExchange::MMLSequenceExchange()
+    : current(nullptr), readerEpoch(0), nextSerial(1)
+{
+}
+
+MMLSequenceExchange::~MMLSequenceExchange()
+{
+    // The audio thread has stopped by the time the processor is destroyed
+    retired.clear();
+    delete current.exchange(nullptr);
+}
+
+void MMLSequenceExchange::publish(std::unique_ptr<MMLCompiledSequence> sequence)
+{
+    sequence->serial = nextSerial++;
+
+    MMLCompiledSequence* previous = current.exchange(sequence.release());
+
+    if (previous != nullptr)
+    {
+        // Any block that starts after this point sees the new sequence, so the old one
+        // only has to outlive a block that may already be running
+        retired.push_back({ std::unique_ptr<MMLCompiledSequence>(previous), readerEpoch.load() });
+    }
+
+    collectGarbage();
+}
+
+void MMLSequenceExchange::collectGarbage()
+{
+    const juce::uint64 epoch = readerEpoch.load();
+
+    // A sequence is safe to free if the reader was idle when it was retired (even epoch),
+    // or has since left the block it was in (epoch moved on)
+    retired.erase(std::remove_if(retired.begin(), retired.end(),
+                                 [epoch] (const RetiredSequence& r) { return (r.readerEpoch & 1) == 0 || r.readerEpoch != epoch; }),
+                  retired.end());
+}
+
+const MMLCompiledSequence* MMLSequenceExchange::getLatest() const
+{
+    return current.load();
+}
+
+//==============================================================================
+MMLSequenceExchange::ReadScope::ReadScope(MMLSequenceExchange& exchange) noexcept
+    : owner(exchange)
+{
+    owner.readerEpoch.fetch_add(1);
+    sequence = owner.current.load();
+}
+
+MMLSequenceExchange::ReadScope::~ReadScope() noexcept
+{
+    owner.readerEpoch.fetch_add(1);
+}
+
+} // namespace MMLPlugin
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "MMLCompiledSequence.h"
+
+namespace MMLPlugin {
+
+/**
+ * MMLSequenceExchange - Lock-free handoff of compiled sequences to the audio thread
+ *
+ * A new sequence is published with a single atomic pointer swap. The previous one
+ * is retired and only freed on the publishing side once the audio thread can no
+ * longer be reading it (RCU-style, tracked with a reader epoch counter).
+ * The audio thread never blocks, allocates or frees.
+ *
+ * Threading: publish(), collectGarbage() and getLatest() are the writer side and
+ * must not run concurrently with each other; callers serialise them with a lock.
+ * Retired sequences are freed on whichever thread publishes, which in the plugin
+ * is MMLCompileWorker's thread (or the host's thread during prepareToPlay), never
+ * the audio thread. ReadScope is used by a single reader, the audio thread.
+ */
+class MMLSequenceExchange
+{
+public:
+    MMLSequenceExchange();
+    ~MMLSequenceExchange();
+
+    /**
+     * Publishes a new sequence and retires the previous one.
+     * @param sequence Fully built sequence; it must not be modified afterwards.
+     */
+    void publish(std::unique_ptr<MMLCompiledSequence> sequence);
+
+    /** Frees retired sequences that the audio thread can no longer be reading. */
+    void collectGarbage();
+
+    /**
+     * Gets the most recently published sequence.
+     * @return Latest sequence, or nullptr if nothing has been published.
+     */
+    const MMLCompiledSequence* getLatest() const;
+
+    /**
+     * Audio-thread access to the current sequence.
+     * The pointer is valid until the scope ends and must not be kept beyond it.
+     */
+    class ReadScope
+    {
+    public:
+        explicit ReadScope(MMLSequenceExchange& exchange) noexcept;
+        ~ReadScope() noexcept;
+
+        const MMLCompiledSequence* get() const noexcept { return sequence; }
+
+    private:
+        MMLSequenceExchange& owner;
+        const MMLCompiledSequence* sequence;
+
+        JUCE_DECLARE_NON_COPYABLE (ReadScope)
+    };
+
+private:
+    struct RetiredSequence
+    {
+        std::unique_ptr<MMLCompiledSequence> sequence;
+        juce::uint64 readerEpoch; // Reader epoch observed when the sequence was retired
+    };
+
+    std::atomic<MMLCompiledSequence*> current;
+    std::atomic<juce::uint64> readerEpoch; // Odd while the audio thread is inside a ReadScope
+    std::vector<RetiredSequence> retired;
+    juce::uint64 nextSerial;
+
+    JUCE_DECLARE_NON_COPYABLE (MMLSequenceExchange)
+};
+
+} // namespace MMLPlugin
@@ -36,11 +36,15 @@ MMLPluginEditor::MMLPluginEditor (MMLPluginProcessor& p)
     statusLabel.setJustificationType(juce::Justification::centred);
     addAndMakeVisible(statusLabel);
     
+    audioProcessor.addChangeListener(this);
+    
     setSize (500, 400);
 }
 
 MMLPluginEditor::~MMLPluginEditor()
 {
+    stopTimer();
+    audioProcessor.removeChangeListener(this);
     mmlTextEditor.removeListener(this);
     convertButton.removeListener(this);
 }
@@ -76,11 +80,15 @@ void MMLPluginEditor::textEditorTextChanged(juce::TextEditor& editor)
     if (&editor == &mmlTextEditor)
     {
         audioProcessor.setMMLText(mmlTextEditor.getText());
+        
+        // Restarting the timer on every keystroke debounces the recompile
+        startTimer(recompileDelayMs);
     }
 }
 
 void MMLPluginEditor::textEditorReturnKeyPressed(juce::TextEditor& editor)
 {
+    juce::ignoreUnused(editor);
 }
 
 void MMLPluginEditor::textEditorEscapeKeyPressed(juce::TextEditor& editor)
@@ -104,8 +112,21 @@ void MMLPluginEditor::buttonClicked(juce::Button* button)
     }
 }
 
+void MMLPluginEditor::timerCallback()
+{
+    stopTimer();
+    
+    const juce::String mmlText = mmlTextEditor.getText();
+    
+    // Keep the sequence current while typing, without restarting playback
+    if (mmlText.isNotEmpty())
+        audioProcessor.processMMLAsync(mmlText, false);
+}
+
 void MMLPluginEditor::processMMLText()
 {
+    stopTimer();
+    
     juce::String mmlText = mmlTextEditor.getText();
     
     if (mmlText.isEmpty())
@@ -114,16 +135,25 @@ void MMLPluginEditor::processMMLText()
         return;
     }
     
-    bool success = audioProcessor.processMML(mmlText);
+    statusLabel.setText("Converting...", juce::dontSendNotification);
+    audioProcessor.processMMLAsync(mmlText, true);
+}
+
+void MMLPluginEditor::changeListenerCallback(juce::ChangeBroadcaster*)
+{
+    const auto status = audioProcessor.getLastCompileStatus();
     
-    if (success)
+    if (!status.success)
+    {
+        statusLabel.setText(status.errorMessage, juce::dontSendNotification);
+    }
+    else if (status.startedPlayback)
     {
-        int numEvents = audioProcessor.getMidiSequence().getNumEvents();
-        statusLabel.setText("SUCCESS: " + juce::String(numEvents) + " MIDI events sent to Cubase track", juce::dontSendNotification);
+        statusLabel.setText("SUCCESS: " + juce::String(status.numEvents) + " MIDI events sent to Cubase track", juce::dontSendNotification);
     }
     else
     {
-        statusLabel.setText(audioProcessor.getErrorMessage(), juce::dontSendNotification);
+        statusLabel.setText("Up to date: " + juce::String(status.numEvents) + " MIDI events", juce::dontSendNotification);
     }
 }
 
@@ -11,7 +11,9 @@ namespace MMLPlugin {
  */
 class MMLPluginEditor  : public juce::AudioProcessorEditor,
                          private juce::TextEditor::Listener,
-                         private juce::Button::Listener
+                         private juce::Button::Listener,
+                         private juce::ChangeListener,
+                         private juce::Timer
 {
 public:
     MMLPluginEditor (MMLPluginProcessor&);
@@ -31,8 +33,17 @@ private:
     // Implementation of Button::Listener
     void buttonClicked (juce::Button*) override;
     
+    // Compile results from the processor's background compiler
+    void changeListenerCallback (juce::ChangeBroadcaster*) override;
+    
+    // Debounced recompile after typing stops
+    void timerCallback() override;
+    
     // Method to process MML text
     void processMMLText();
+    
+    /** Delay after the last keystroke before the text is recompiled. */
+    static constexpr int recompileDelayMs = 300;
 
     // Reference to processor
     MMLPluginProcessor& audioProcessor;
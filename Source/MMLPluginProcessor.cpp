@@ -1,18 +1,21 @@
 #include "MMLPluginProcessor.h"
 #include "MMLPluginEditor.h"
 #include "MMLParser/EnhancedMMLParser.h"
+#include <functional>
+#include "MMLPlayback/MMLRealtimeAuditLockCheck.h"
 
 namespace MMLPlugin {
 //==============================================================================
 MMLPluginProcessor::MMLPluginProcessor()
     : AudioProcessor(BusesProperties())
     , parameters(*this, nullptr, "Parameters", {})
+    , compileWorker([this] (const MMLCompileWorker::Request& request, const std::atomic<bool>& cancelFlag) {
+          return compileMML(request.mmlText, request.startPlayback, &cancelFlag) != CompileResult::Cancelled;
+      })
 {
     needsMidiUpdate = false;
     lastMidiSendTime = 0;
-    sequenceStartTime = 0.0;
-    sequenceIsPlaying = false;
-    nextEventIndex = 0;
+    playbackSampleRate = 44100.0; // Until the host calls prepareToPlay
 }
 
 MMLPluginProcessor::~MMLPluginProcessor()
@@ -75,11 +78,26 @@ void MMLPluginProcessor::changeProgramName(int index, const juce::String& newNam
 void MMLPluginProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
     // Initialization before playback
-    juce::ignoreUnused(sampleRate, samplesPerBlock);
+    juce::ignoreUnused(samplesPerBlock);
+    
+    // The audio thread is not running here, so playback state can be reset directly
+    scheduler.reset();
+    
+    // Event sample positions depend on the sample rate: republish the current sequence resolved for the new one
+    const MMLRealtimeAudit::AuditedScopedLock lock(publishLock);
+    playbackSampleRate = sampleRate;
+    
+    const MMLCompiledSequence* latest = sequenceExchange.getLatest();
+    const bool hasEvents = latest != nullptr && ! latest->score->isEmpty();
+    
+    // Any change of rate, however small, moves the sample positions, so the compare is exact
+    if (latest != nullptr && std::not_equal_to<double>()(latest->sampleRate, sampleRate)) {
+        publishSequence(std::make_unique<MMLCompiledSequence>(*latest));
+    }
     
     // Don't clear sequence - let it persist between playback sessions
     // Instead, mark that we need to process it
-    if (currentSequence.getNumEvents() > 0) {
+    if (hasEvents) {
         needsMidiUpdate = true;
     }
 }
@@ -105,71 +123,70 @@ bool MMLPluginProcessor::isBusesLayoutSupported(const BusesLayout& layouts) cons
 
 void MMLPluginProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
 {
+    // Nothing below may allocate, free, lock or log; the RT audit build checks this
+    MMLRealtimeAudit::RealtimeSection realtimeSection;
+    
     // Clear audio buffer (MIDI-only plugin)
     buffer.clear();
     
-    // If new MIDI data needs to be processed
-    if (needsMidiUpdate && currentSequence.getNumEvents() > 0) {
-        // Start the sequence playback
-        sequenceStartTime = juce::Time::getMillisecondCounterHiRes() / 1000.0;
-        sequenceIsPlaying = true;
-        nextEventIndex = 0;
-        needsMidiUpdate = false;
-        
-        DBG("Starting MIDI sequence playback with " + juce::String(currentSequence.getNumEvents()) + " events");
-    }
+    // Read the restart request before the sequence: it is raised after publishing,
+    // so a request seen here always comes with the sequence it was raised for
+    const bool restartRequested = needsMidiUpdate.exchange(false);
+    
+    MMLSequenceExchange::ReadScope sequenceScope(sequenceExchange);
+    const MMLCompiledSequence* compiled = sequenceScope.get();
     
-    // Process MIDI events if sequence is playing
-    if (sequenceIsPlaying && currentSequence.getNumEvents() > 0) {
-        double currentTime = juce::Time::getMillisecondCounterHiRes() / 1000.0;
-        double elapsedTime = currentTime - sequenceStartTime;
+    if (compiled == nullptr)
+        return;
         
-        // Process events that should occur in this buffer
-        int bufferSamples = buffer.getNumSamples();
-        double bufferDuration = bufferSamples / getSampleRate();
+    // A send request starts a preview; it is only audible while the host transport is stopped
+    if (restartRequested && ! compiled->score->isEmpty())
+        scheduler.startPreview();
         
-        // Check all events to see if they should be played now
-        while (nextEventIndex < currentSequence.getNumEvents()) {
-            const auto* event = currentSequence.getEventPointer(nextEventIndex);
-            double eventTime = event->message.getTimeStamp();
-            
-            // If event time has passed or is within this buffer
-            if (eventTime <= elapsedTime + bufferDuration) {
-                // Calculate sample position within current buffer
-                double timeInBuffer = eventTime - elapsedTime;
-                int samplePosition = static_cast<int>(timeInBuffer * getSampleRate());
-                
-                // Clamp to buffer bounds
-                samplePosition = juce::jlimit(0, bufferSamples - 1, samplePosition);
-                
-                // Add the event to output
-                juce::MidiMessage message = event->message;
-                midiMessages.addEvent(message, samplePosition);
-                
-                DBG("Playing MIDI event at time " + juce::String(eventTime) + 
-                    "s (elapsed: " + juce::String(elapsedTime) + 
-                    "s, sample: " + juce::String(samplePosition) + ")");
-                
-                if (message.isNoteOn()) {
-                    DBG("  Note ON: " + juce::String(message.getNoteNumber()) + 
-                        " velocity " + juce::String(message.getVelocity()));
-                } else if (message.isNoteOff()) {
-                    DBG("  Note OFF: " + juce::String(message.getNoteNumber()));
-                }
-                
-                nextEventIndex++;
-            } else {
-                // No more events for this buffer
-                break;
-            }
-        }
+    scheduler.process(*compiled, getHostTransport(), buffer.getNumSamples(), midiMessages);
+}
+
+MMLPlaybackScheduler::Transport MMLPluginProcessor::getHostTransport() const
+{
+    MMLPlaybackScheduler::Transport transport;
+    
+    auto* playHead = getPlayHead();
+    if (playHead == nullptr)
+        return transport;
+        
+    const auto position = playHead->getPosition();
+    if (! position.hasValue() || ! position->getIsPlaying())
+        return transport;
         
-        // Check if sequence is complete
-        if (nextEventIndex >= currentSequence.getNumEvents()) {
-            sequenceIsPlaying = false;
-            DBG("MIDI sequence playback completed");
+    const double sampleRate = getSampleRate();
+    const auto ppq = position->getPpqPosition();
+    const auto bpm = position->getBpm();
+    const bool hasMusicalTime = ppq.hasValue() && bpm.hasValue() && *bpm > 0.0;
+    
+    // Converts a distance in quarter notes to samples at the host's current tempo
+    auto quarterNotesToSamples = [&] (double quarterNotes) {
+        return static_cast<juce::int64>(std::llround(quarterNotes * 60.0 / *bpm * sampleRate));
+    };
+    
+    if (const auto timeInSamples = position->getTimeInSamples()) {
+        transport.isPlaying = true;
+        transport.samplePosition = *timeInSamples;
+    } else if (hasMusicalTime) {
+        // Hosts that only report musical time
+        transport.isPlaying = true;
+        transport.samplePosition = quarterNotesToSamples(*ppq);
+    }
+    
+    // Cycle points are given in PPQ; place them relative to this block's start
+    if (transport.isPlaying && position->getIsLooping() && hasMusicalTime) {
+        if (const auto loopPoints = position->getLoopPoints()) {
+            transport.isLooping = true;
+            transport.loopStart = transport.samplePosition + quarterNotesToSamples(loopPoints->ppqStart - *ppq);
+            transport.loopEnd = transport.samplePosition + quarterNotesToSamples(loopPoints->ppqEnd - *ppq);
         }
     }
+    
+    return transport;
 }
 
 //==============================================================================
@@ -206,54 +223,153 @@ void MMLPluginProcessor::setStateInformation(const void* data, int sizeInBytes)
 
 //==============================================================================
 
-bool MMLPluginProcessor::processMML(const juce::String& mmlText)
+bool MMLPluginProcessor::processMML(const juce::String& textToProcess)
 {
     // Save MML text
-    this->mmlText = mmlText;
+    mmlText = textToProcess;
     
-    // Use enhanced MML parser
-    EnhancedMMLParser parser;
-    bool success = parser.parse(mmlText);
+    return compileMML(textToProcess, true, nullptr) == CompileResult::Succeeded;
+}
+
+void MMLPluginProcessor::processMMLAsync(const juce::String& textToCompile, bool startPlayback)
+{
+    compileWorker.submit(textToCompile, startPlayback);
+}
+
+MMLPluginProcessor::CompileResult MMLPluginProcessor::compileMML(const juce::String& textToCompile, bool startPlayback, const std::atomic<bool>* cancelFlag)
+{
+    auto isCancelled = [cancelFlag] { return cancelFlag != nullptr && cancelFlag->load(); };
     
-    if (!success) {
-        // Set error message on parse failure
-        errorMessage = "MML ERROR: " + parser.getError();
-        return false;
-    }
+    const MMLRealtimeAudit::AuditedScopedLock lock(parserLock);
     
-    // Clear previous error message
-    errorMessage = "";
+    // A score already compiled by this or any other instance is shared rather than compiled again
+    const std::string_view source(textToCompile.toRawUTF8(), textToCompile.getNumBytesAsUTF8());
+    std::shared_ptr<const MMLCompiledScore> score = compileCache->find(source);
     
-    // Generate MIDI sequence from parsed MML
-    currentSequence = parser.generateMidi();
+    if (score == nullptr) {
+        // The parser is kept between compiles, so an edit only reparses the text around it
+        parser.setCancelFlag(cancelFlag);
+        bool success = parser.reparse(source);
+        
+        // A cancelled compile has been superseded by a newer one, which will report instead
+        if (isCancelled())
+            return CompileResult::Cancelled;
+            
+        if (!success) {
+            // Set error message on parse failure
+            CompileStatus status;
+            status.errorMessage = "MML ERROR: " + parser.getError();
+            setCompileStatus(status);
+            return CompileResult::Failed;
+        }
+        
+        // Generate MIDI sequence from parsed MML, off the audio thread
+        auto newScore = std::make_shared<MMLCompiledScore>();
+        
+        if (parser.isExpanded()) {
+            parser.generateEvents(eventBuffer);
+            newScore->events.assign(eventBuffer.begin(), eventBuffer.end());
+            newScore->tempoMap = parser.getTempoMap();
+            newScore->sequence = parser.generateMidi();
+        } else {
+            // Too long to expand: the audio thread runs the track programs as it plays.
+            // Tracks already held by another score are shared rather than copied
+            for (int i = 0; i < parser.getNumTracks(); ++i)
+                newScore->programs.push_back(compileCache->shareProgram(parser.getProgram(i)));
+                
+            if (! newScore->buildSeekTable(cancelFlag))
+                return CompileResult::Cancelled;
+        }
+        
+        // An empty result is reported below and not worth sharing
+        if (newScore->isEmpty())
+            score = std::move(newScore);
+        else
+            score = compileCache->insert(source, std::move(newScore));
+    }
+    
+    CompileStatus status;
+    const int numEvents = static_cast<int>(juce::jmin(score->getNumEvents(), juce::int64(std::numeric_limits<int>::max())));
     
     // Debug output
-    DBG("Generated MIDI sequence with " + juce::String(currentSequence.getNumEvents()) + " events");
+    DBG("Generated MIDI sequence with " + juce::String(numEvents) + " events");
     
     // Check if MML parsing produced any events
-    if (currentSequence.getNumEvents() == 0) {
-        errorMessage = "MML parsing produced no MIDI events. Please check your MML syntax.";
+    if (numEvents == 0) {
+        status.errorMessage = "MML parsing produced no MIDI events. Please check your MML syntax.";
         DBG("No MIDI events generated from MML input");
-        return false;
+        setCompileStatus(status);
+        return CompileResult::Failed;
     }
     
-    // Mark that MIDI update is needed
-    needsMidiUpdate = true;
+    if (isCancelled())
+        return CompileResult::Cancelled;
+        
+    status.success = true;
+    status.numEvents = numEvents;
     
-    // Immediately send MIDI to track
-    sendMidiToTrack();
+    // Hand the sequence over to the audio thread
+    auto compiled = std::make_unique<MMLCompiledSequence>();
+    compiled->score = std::move(score);
+    publishSequence(std::move(compiled));
     
-    return true;
+    if (startPlayback) {
+        // Mark that MIDI update is needed
+        needsMidiUpdate = true;
+        
+        // Immediately send MIDI to track
+        sendMidiToTrack();
+        status.startedPlayback = true;
+    }
+    
+    setCompileStatus(status);
+    return CompileResult::Succeeded;
 }
 
-const juce::MidiMessageSequence& MMLPluginProcessor::getMidiSequence() const
+void MMLPluginProcessor::setCompileStatus(const CompileStatus& status)
 {
-    return currentSequence;
+    {
+        const MMLRealtimeAudit::AuditedScopedLock lock(statusLock);
+        lastCompileStatus = status;
+    }
+    
+    // Delivered asynchronously on the message thread
+    sendChangeMessage();
+}
+
+MMLPluginProcessor::CompileStatus MMLPluginProcessor::getLastCompileStatus() const
+{
+    const MMLRealtimeAudit::AuditedScopedLock lock(statusLock);
+    return lastCompileStatus;
+}
+
+void MMLPluginProcessor::publishSequence(std::unique_ptr<MMLCompiledSequence> compiled)
+{
+    // Resolving and publishing under one lock means a sequence can never be published
+    // for a sample rate that prepareToPlay has already replaced
+    const MMLRealtimeAudit::AuditedScopedLock lock(publishLock);
+    
+    compiled->resolveSamplePositions(playbackSampleRate);
+    sequenceExchange.publish(std::move(compiled));
+}
+
+MMLCompileCache::Statistics MMLPluginProcessor::getCompileCacheStatistics() const
+{
+    return compileCache->getStatistics();
+}
+
+juce::MidiMessageSequence MMLPluginProcessor::getMidiSequence() const
+{
+    // Copied under the publish lock: a compile finishing on the worker thread may free the current sequence
+    const MMLRealtimeAudit::AuditedScopedLock lock(publishLock);
+    
+    const MMLCompiledSequence* latest = sequenceExchange.getLatest();
+    return latest != nullptr ? latest->score->sequence : juce::MidiMessageSequence();
 }
 
 juce::String MMLPluginProcessor::getErrorMessage() const
 {
-    return errorMessage;
+    return getLastCompileStatus().errorMessage;
 }
 
 void MMLPluginProcessor::sendMidiToTrack()
@@ -262,6 +378,9 @@ void MMLPluginProcessor::sendMidiToTrack()
     lastMidiSendTime = juce::Time::currentTimeMillis();
     needsMidiUpdate = true;
     
+   #if JUCE_DEBUG
+    const juce::MidiMessageSequence currentSequence = getMidiSequence();
+    
     DBG("=== MML to MIDI conversion requested ===");
     DBG("MIDI sequence contains " + juce::String(currentSequence.getNumEvents()) + " events");
     
@@ -284,6 +403,7 @@ void MMLPluginProcessor::sendMidiToTrack()
     
     DBG("Total: " + juce::String(noteOnCount) + " note-on, " + juce::String(noteOffCount) + " note-off events");
     DBG("Sequence will start playing in next audio callback");
+   #endif
 }
 
 juce::String MMLPluginProcessor::getMMLText() const
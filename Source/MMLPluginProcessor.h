@@ -3,6 +3,11 @@
 #include <JuceHeader.h>
 #include <atomic>
 #include "MMLParser/EnhancedMMLParser.h"
+#include "MMLCompileCache.h"
+#include "MMLCompileWorker.h"
+#include "MMLPlayback/MMLPlaybackScheduler.h"
+#include "MMLPlayback/MMLRealtimeAudit.h"
+#include "MMLPlayback/MMLSequenceExchange.h"
 
 namespace MMLPlugin {
 
@@ -12,9 +17,19 @@ namespace MMLPlugin {
  * 
  * This class parses Music Macro Language (MML) text and converts it to MIDI data for sending to a Cubase track.
  */
-class MMLPluginProcessor : public juce::AudioProcessor
+class MMLPluginProcessor : public juce::AudioProcessor,
+                           public juce::ChangeBroadcaster
 {
 public:
+    /** Outcome of the most recent compile, reported to listeners with a change message. */
+    struct CompileStatus
+    {
+        bool success = false;
+        bool startedPlayback = false; // The compile was a Convert and playback was started
+        int numEvents = 0;
+        juce::String errorMessage;
+    };
+
     //==============================================================================
     MMLPluginProcessor();
     ~MMLPluginProcessor() override;
@@ -56,16 +71,37 @@ public:
     
     /**
      * Processes MML text and converts it to a MIDI sequence.
-     * @param mmlText MML text to process
+     * @param textToProcess MML text to process
      * @return True if processing succeeded, false otherwise.
      */
-    bool processMML(const juce::String& mmlText);
+    bool processMML(const juce::String& textToProcess);
+    
+    /**
+     * Compiles MML text on the background compile thread and returns immediately.
+     * A newer call cancels a compile still in progress. Listeners receive a change
+     * message when a compile finishes; see getLastCompileStatus().
+     * @param textToCompile MML text to compile.
+     * @param startPlayback True to start playback once compiled (as the Convert button does).
+     */
+    void processMMLAsync(const juce::String& textToCompile, bool startPlayback);
+    
+    /**
+     * Gets the outcome of the most recent finished compile.
+     * @return Compile status.
+     */
+    CompileStatus getLastCompileStatus() const;
+    
+    /**
+     * Gets the hit and miss counters of the compiled score store shared by all instances.
+     * @return Cache statistics.
+     */
+    MMLCompileCache::Statistics getCompileCacheStatistics() const;
     
     /**
-     * Gets the current MIDI sequence.
+     * Gets a copy of the current MIDI sequence.
      * @return MIDI message sequence.
      */
-    const juce::MidiMessageSequence& getMidiSequence() const;
+    juce::MidiMessageSequence getMidiSequence() const;
     
     /**
      * Gets the error message after processing.
@@ -91,18 +127,44 @@ public:
     void setMMLText(const juce::String& text);
 
 private:
+    /** Reads the host transport for the current block (audio thread). */
+    MMLPlaybackScheduler::Transport getHostTransport() const;
+    
+    /** Resolves a compiled sequence for the playback sample rate and hands it to the audio thread. */
+    void publishSequence(std::unique_ptr<MMLCompiledSequence> compiled);
+    
+    enum class CompileResult
+    {
+        Succeeded,
+        Failed,
+        Cancelled // Superseded by a newer request before anything was published
+    };
+    
+    /** Compiles and publishes MML text on the calling thread. */
+    CompileResult compileMML(const juce::String& textToCompile, bool startPlayback, const std::atomic<bool>* cancelFlag);
+    
+    void setCompileStatus(const CompileStatus& status);
+    
     //==============================================================================
     juce::AudioProcessorValueTreeState parameters;
-    juce::MidiMessageSequence currentSequence;
+    MMLSequenceExchange sequenceExchange;
+    juce::CriticalSection publishLock; // Serialises publishing against sample rate changes
+    double playbackSampleRate;
     juce::String mmlText;
-    juce::String errorMessage;
+    juce::CriticalSection parserLock; // Compiles can come from the worker and from processMML
+    EnhancedMMLParser parser;         // Reused so edits are reparsed incrementally, without allocating
+    std::vector<MMLMidiEvent> eventBuffer; // Scratch for generated events, guarded by parserLock
+    juce::SharedResourcePointer<MMLCompileCache> compileCache; // One store for every instance in the process
+    juce::CriticalSection statusLock;
+    CompileStatus lastCompileStatus;
     std::atomic<bool> needsMidiUpdate;
     juce::int64 lastMidiSendTime;
     
-    // MIDI event scheduling
-    double sequenceStartTime;
-    bool sequenceIsPlaying;
-    int nextEventIndex;
+    // MIDI event scheduling (audio thread only)
+    MMLPlaybackScheduler scheduler;
+    
+    // Declared last: its thread calls back into the members above, so it must stop first
+    MMLCompileWorker compileWorker;
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MMLPluginProcessor)
 };
@@ -0,0 +1,647 @@
+/**
+ * MMLBatchConvert - Converts .mml files to Standard MIDI Files from the command line
+ *
+ *   MMLBatchConvert [--output <dir>] [--threads <n>] [--list <file>] <file or directory>...
+ *
+ * Directories are searched recursively for .mml files, and a list file names one input
+ * per line. Every input is memory-mapped and compiled with EnhancedMMLParser, then its
+ * events are written to the .mid file as an MMLEventStream plays them: no event list or
+ * MidiMessageSequence is built, so scores too long to expand convert as well.
+ *
+ * Files are spread over one worker thread per core. Each worker starts with an equal
+ * share of the files; one that runs out takes half of what another has left, so a few
+ * large scores do not hold up the rest. Throughput totals are printed at the end.
+ *
+ * Output is a format 0 file at MMLTime::ticksPerQuarterNote ticks per quarter note, with
+ * the score's tempo changes. Track N of the score plays on MIDI channel N, as in the
+ * plugin. Each file is written under a temporary name and then moved into place, so an
+ * interrupted run leaves no partial files. The exit code is 1 if any file failed.
+ */
+
+#include <JuceHeader.h>
+#include "EnhancedMMLParser.h"
+#include "MMLEventStream.h"
+#include "MMLTime.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    //==============================================================================
+    // Standard MIDI File output
+
+    /**
+     * Writes a format 0 Standard MIDI File to a stream, one event at a time. The length
+     * of the track is only known at the end, so finish() goes back to fill it in: the
+     * stream must be able to seek, as a file can.
+     */
+    class MidiFileWriter
+    {
+    public:
+        explicit MidiFileWriter(juce::OutputStream& stream)
+            : out(stream)
+        {
+        }
+
+        bool writeHeader()
+        {
+            constexpr int division = MMLTime::ticksPerQuarterNote;
+
+            const juce::uint8 header[] = {
+                'M', 'T', 'h', 'd', 0, 0, 0, 6,
+                0, 0,                    // Format 0: a single track
+                0, 1,                    // Number of tracks
+                static_cast<juce::uint8>(division >> 8), static_cast<juce::uint8>(division & 0xff),
+                'M', 'T', 'r', 'k', 0, 0, 0, 0 // Length filled in by finish()
+            };
+
+            trackLengthPosition = out.getPosition() + static_cast<juce::int64>(sizeof(header)) - 4;
+            return out.write(header, sizeof(header));
+        }
+
+        /** Writes a three-byte channel message. Events must come in tick order. */
+        void writeChannelEvent(juce::int64 tick, const juce::uint8* data)
+        {
+            juce::uint8 bytes[maxDeltaBytes + 3];
+            int size = writeDelta(tick, bytes);
+
+            // Running status: a status byte equal to the previous one is left out
+            if (data[0] != runningStatus)
+            {
+                bytes[size++] = data[0];
+                runningStatus = data[0];
+            }
+
+            bytes[size++] = data[1];
+            bytes[size++] = data[2];
+            out.write(bytes, static_cast<size_t>(size));
+        }
+
+        /** Writes a tempo change. Events must come in tick order. */
+        void writeTempo(juce::int64 tick, double bpm)
+        {
+            const int microsecondsPerQuarterNote = juce::jlimit(1, 0xffffff, juce::roundToInt(60000000.0 / bpm));
+
+            juce::uint8 bytes[maxDeltaBytes + 6];
+            int size = writeDelta(tick, bytes);
+
+            bytes[size++] = 0xff;
+            bytes[size++] = 0x51;
+            bytes[size++] = 3;
+            bytes[size++] = static_cast<juce::uint8>(microsecondsPerQuarterNote >> 16);
+            bytes[size++] = static_cast<juce::uint8>(microsecondsPerQuarterNote >> 8);
+            bytes[size++] = static_cast<juce::uint8>(microsecondsPerQuarterNote);
+
+            runningStatus = 0; // Meta events cancel running status
+            out.write(bytes, static_cast<size_t>(size));
+        }
+
+        /** Ends the track and fills in its length. @return False if the stream failed. */
+        bool finish()
+        {
+            const juce::uint8 endOfTrack[] = { 0, 0xff, 0x2f, 0 };
+
+            if (! out.write(endOfTrack, sizeof(endOfTrack)))
+                return false;
+
+            const juce::int64 trackEnd = out.getPosition();
+            const juce::int64 trackLength = trackEnd - (trackLengthPosition + 4);
+
+            if (trackLength > 0xffffffffLL)
+                return false;
+
+            return out.setPosition(trackLengthPosition)
+                && out.writeIntBigEndian(static_cast<int>(static_cast<juce::uint32>(trackLength)))
+                && out.setPosition(trackEnd);
+        }
+
+    private:
+        static constexpr int maxDeltaBytes = 4;
+        static constexpr juce::int64 maxDelta = 0x0fffffff; // Largest four-byte variable-length quantity
+
+        /** Puts the time since the previous event in bytes as a variable-length quantity. @return Its size. */
+        int writeDelta(juce::int64 tick, juce::uint8* bytes)
+        {
+            juce::int64 delta = tick - lastTick;
+            lastTick = tick;
+
+            // A gap too long for one delta is bridged with empty text events
+            while (delta > maxDelta)
+            {
+                juce::uint8 filler[maxDeltaBytes + 3];
+                int size = encodeQuantity(static_cast<juce::uint32>(maxDelta), filler);
+                filler[size++] = 0xff;
+                filler[size++] = 0x01;
+                filler[size++] = 0;
+                out.write(filler, static_cast<size_t>(size));
+
+                runningStatus = 0;
+                delta -= maxDelta;
+            }
+
+            return encodeQuantity(static_cast<juce::uint32>(delta), bytes);
+        }
+
+        static int encodeQuantity(juce::uint32 value, juce::uint8* bytes)
+        {
+            // Seven bits per byte, most significant first; every byte but the last has its top bit set
+            juce::uint8 groups[maxDeltaBytes];
+            int numGroups = 0;
+
+            do
+            {
+                groups[numGroups++] = static_cast<juce::uint8>(value & 0x7f);
+                value >>= 7;
+            }
+            while (value != 0 && numGroups < maxDeltaBytes);
+
+            for (int i = 0; i < numGroups; i++)
+                bytes[i] = static_cast<juce::uint8>(groups[numGroups - 1 - i] | (i < numGroups - 1 ? 0x80 : 0));
+
+            return numGroups;
+        }
+
+        juce::OutputStream& out;
+        juce::int64 trackLengthPosition = 0;
+        juce::int64 lastTick = 0;
+        juce::uint8 runningStatus = 0;
+    };
+
+    //==============================================================================
+    // Conversion
+
+    struct Job
+    {
+        juce::File input;
+        juce::File output;
+    };
+
+    struct Statistics
+    {
+        int converted = 0;
+        int failed = 0;
+        juce::int64 inputBytes = 0;
+        juce::int64 outputBytes = 0;
+        juce::int64 notes = 0;
+        double parseSeconds = 0.0; // Summed over the files, so over all threads
+        double writeSeconds = 0.0;
+
+        void add(const Statistics& other)
+        {
+            converted += other.converted;
+            failed += other.failed;
+            inputBytes += other.inputBytes;
+            outputBytes += other.outputBytes;
+            notes += other.notes;
+            parseSeconds += other.parseSeconds;
+            writeSeconds += other.writeSeconds;
+        }
+    };
+
+    double getSeconds()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /** What one worker thread keeps from file to file, so that converting a file allocates little. */
+    struct Converter
+    {
+        Converter()
+        {
+            // The files are the unit of parallelism; tracks of one file stay on its worker
+            parser.setParallelTrackParsing(false);
+            stream.setIncludesTempoChanges(true);
+        }
+
+        /** @return False, with an error message, if the file could not be converted. */
+        bool convert(const Job& job, Statistics& statistics, juce::String& error)
+        {
+            const double startTime = getSeconds();
+            const juce::int64 inputSize = job.input.getSize();
+            std::optional<juce::MemoryMappedFile> mapped;
+            std::string_view text;
+
+            // An empty file cannot be mapped, and is an empty score
+            if (inputSize > 0)
+            {
+                mapped.emplace(job.input, juce::MemoryMappedFile::readOnly);
+
+                if (mapped->getData() == nullptr)
+                {
+                    error = "cannot read the file";
+                    return false;
+                }
+
+                text = std::string_view(static_cast<const char*>(mapped->getData()), mapped->getSize());
+            }
+
+            // Editors on Windows often start UTF-8 files with a byte order mark
+            if (text.size() >= 3 && text.substr(0, 3) == "\xef\xbb\xbf")
+                text.remove_prefix(3);
+
+            if (! parser.parse(text))
+            {
+                error = parser.getError();
+                return false;
+            }
+
+            const double parsedTime = getSeconds();
+            juce::int64 notes = 0;
+            juce::int64 outputBytes = 0;
+
+            const juce::Result created = job.output.getParentDirectory().createDirectory();
+
+            if (created.failed())
+            {
+                error = created.getErrorMessage();
+                return false;
+            }
+
+            juce::TemporaryFile temporary(job.output);
+
+            {
+                juce::FileOutputStream out(temporary.getFile(), outputBufferSize);
+
+                if (out.failedToOpen() || ! writeMidiFile(out, notes))
+                {
+                    error = "cannot write " + job.output.getFullPathName();
+                    return false;
+                }
+
+                out.flush();
+                outputBytes = out.getPosition();
+
+                if (out.getStatus().failed())
+                {
+                    error = out.getStatus().getErrorMessage();
+                    return false;
+                }
+            }
+
+            if (! temporary.overwriteTargetFileWithTemporary())
+            {
+                error = "cannot replace " + job.output.getFullPathName();
+                return false;
+            }
+
+            statistics.inputBytes += inputSize;
+            statistics.outputBytes += outputBytes;
+            statistics.notes += notes;
+            statistics.parseSeconds += parsedTime - startTime;
+            statistics.writeSeconds += getSeconds() - parsedTime;
+            return true;
+        }
+
+    private:
+        static constexpr size_t outputBufferSize = 64 * 1024;
+
+        bool writeMidiFile(juce::OutputStream& out, juce::int64& notes)
+        {
+            const int numTracks = parser.getNumTracks();
+            programs.resize(static_cast<size_t>(numTracks));
+
+            for (int i = 0; i < numTracks; i++)
+                programs[static_cast<size_t>(i)] = parser.getProgram(i);
+
+            // The file is written in ticks; sample positions are not used
+            stream.setTracks(programs.data(), numTracks, 1000.0);
+
+            MidiFileWriter writer(out);
+
+            if (! writer.writeHeader())
+                return false;
+
+            for (; ! stream.isFinished(); stream.advance())
+            {
+                const MMLMidiEvent& event = stream.getEvent();
+
+                if (stream.isTempoChange())
+                {
+                    writer.writeTempo(event.tick, stream.getTempo());
+                }
+                else
+                {
+                    writer.writeChannelEvent(event.tick, event.data);
+
+                    if (event.isNoteOn())
+                        notes++;
+                }
+            }
+
+            return writer.finish();
+        }
+
+        EnhancedMMLParser parser;
+        MMLEventStream stream;
+        std::vector<MMLProgram> programs; // Copies of the parser's track programs, which the stream plays
+    };
+
+    //==============================================================================
+    // Work stealing
+
+    /**
+     * Hands out job numbers to a fixed set of workers. Each worker owns a range of jobs
+     * and takes them from its front; a worker whose range is empty steals the back half
+     * of the largest range left. A range is packed into one atomic word, so taking and
+     * stealing are each a single compare-and-swap, and owner and thieves never lock.
+     */
+    class WorkQueues
+    {
+    public:
+        WorkQueues(int numWorkersToUse, juce::uint32 numJobs)
+            : numWorkers(numWorkersToUse), ranges(new Range[static_cast<size_t>(numWorkersToUse)])
+        {
+            // Equal contiguous shares to start with
+            for (int i = 0; i < numWorkers; i++)
+            {
+                const auto begin = static_cast<juce::uint32>(static_cast<juce::uint64>(numJobs) * static_cast<juce::uint64>(i) / static_cast<juce::uint64>(numWorkers));
+                const auto end = static_cast<juce::uint32>(static_cast<juce::uint64>(numJobs) * static_cast<juce::uint64>(i + 1) / static_cast<juce::uint64>(numWorkers));
+                ranges[static_cast<size_t>(i)].jobs.store(pack(begin, end));
+            }
+        }
+
+        /**
+         * Gets the next job for a worker, stealing if its own range is empty.
+         * @return False once no worker has jobs left.
+         */
+        bool next(int worker, juce::uint32& job)
+        {
+            while (! takeFront(worker, job))
+                if (! steal(worker))
+                    return false;
+
+            return true;
+        }
+
+        int getNumSteals() const
+        {
+            return steals.load();
+        }
+
+    private:
+        struct alignas(64) Range // One cache line each, so workers taking jobs do not slow each other down
+        {
+            std::atomic<juce::uint64> jobs { 0 };
+        };
+
+        static juce::uint64 pack(juce::uint32 begin, juce::uint32 end)  { return (static_cast<juce::uint64>(begin) << 32) | end; }
+        static juce::uint32 getBegin(juce::uint64 range)                { return static_cast<juce::uint32>(range >> 32); }
+        static juce::uint32 getEnd(juce::uint64 range)                  { return static_cast<juce::uint32>(range); }
+
+        bool takeFront(int worker, juce::uint32& job)
+        {
+            auto& jobs = ranges[static_cast<size_t>(worker)].jobs;
+            juce::uint64 range = jobs.load();
+
+            while (getBegin(range) < getEnd(range))
+            {
+                if (jobs.compare_exchange_weak(range, pack(getBegin(range) + 1, getEnd(range))))
+                {
+                    job = getBegin(range);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /** Moves the back half of the largest other range into the thief's own, empty, range. */
+        bool steal(int thief)
+        {
+            for (;;)
+            {
+                int victim = -1;
+                juce::uint64 victimRange = 0;
+                juce::uint32 mostJobs = 0;
+
+                for (int i = 0; i < numWorkers; i++)
+                {
+                    const juce::uint64 range = ranges[static_cast<size_t>(i)].jobs.load();
+
+                    if (i != thief && getBegin(range) < getEnd(range) && getEnd(range) - getBegin(range) > mostJobs)
+                    {
+                        victim = i;
+                        victimRange = range;
+                        mostJobs = getEnd(range) - getBegin(range);
+                    }
+                }
+
+                // Jobs a thief has taken but not yet stored are finished by that thief
+                if (victim < 0)
+                    return false;
+
+                const juce::uint32 middle = getBegin(victimRange) + mostJobs / 2;
+
+                if (ranges[static_cast<size_t>(victim)].jobs.compare_exchange_strong(victimRange, pack(getBegin(victimRange), middle)))
+                {
+                    ranges[static_cast<size_t>(thief)].jobs.store(pack(middle, getEnd(victimRange)));
+                    steals++;
+                    return true;
+                }
+            }
+        }
+
+        const int numWorkers;
+        std::unique_ptr<Range[]> ranges;
+        std::atomic<int> steals { 0 };
+    };
+
+    /** Runs one worker's share of the batch on a thread of its own. */
+    class WorkerThread : public juce::Thread
+    {
+    public:
+        explicit WorkerThread(std::function<void()> workToRun)
+            : juce::Thread("MML batch converter"), work(std::move(workToRun))
+        {
+        }
+
+        void run() override
+        {
+            work();
+        }
+
+    private:
+        std::function<void()> work;
+    };
+
+    //==============================================================================
+    // Inputs
+
+    /** Adds the jobs for one input: a file, or every .mml file below a directory. */
+    bool addInput(const juce::File& input, const juce::File& outputDirectory, std::vector<Job>& jobs)
+    {
+        if (input.isDirectory())
+        {
+            auto files = input.findChildFiles(juce::File::findFiles, true, "*.mml");
+            files.sort();
+
+            // The layout below the directory is kept in the output directory
+            for (const auto& file : files)
+            {
+                const juce::File output = outputDirectory == juce::File() ? file : outputDirectory.getChildFile(file.getRelativePathFrom(input));
+                jobs.push_back({ file, output.withFileExtension("mid") });
+            }
+
+            return true;
+        }
+
+        if (! input.existsAsFile())
+        {
+            std::fprintf(stderr, "No such file or directory: %s\n", input.getFullPathName().toRawUTF8());
+            return false;
+        }
+
+        const juce::File output = outputDirectory == juce::File() ? input : outputDirectory.getChildFile(input.getFileName());
+        jobs.push_back({ input, output.withFileExtension("mid") });
+        return true;
+    }
+
+    /** Adds the inputs named in a list file, one per line; blank lines are skipped. */
+    bool addInputsFromList(const juce::File& list, const juce::File& outputDirectory, std::vector<Job>& jobs)
+    {
+        if (! list.existsAsFile())
+        {
+            std::fprintf(stderr, "Cannot read list file: %s\n", list.getFullPathName().toRawUTF8());
+            return false;
+        }
+
+        juce::StringArray lines;
+        list.readLines(lines);
+
+        for (const auto& line : lines)
+        {
+            const juce::String path = line.trim();
+
+            if (path.isNotEmpty() && ! addInput(juce::File::getCurrentWorkingDirectory().getChildFile(path), outputDirectory, jobs))
+                return false;
+        }
+
+        return true;
+    }
+
+    void printUsage()
+    {
+        std::printf("Usage: MMLBatchConvert [--output <dir>] [--threads <n>] [--list <file>] <file or directory>...\n"
+                    "  --output   Directory for the .mid files (default: next to each input);\n"
+                    "             files found in a directory keep their path below it\n"
+                    "  --threads  Worker threads (default: one per core)\n"
+                    "  --list     File naming one input per line\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const juce::File workingDirectory = juce::File::getCurrentWorkingDirectory();
+    juce::File outputDirectory;
+    int numThreads = juce::SystemStats::getNumCpus();
+    juce::StringArray inputs, lists;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const juce::String option(argv[i]);
+        const bool hasValue = i + 1 < argc;
+
+        if (option == "--output" && hasValue)
+            outputDirectory = workingDirectory.getChildFile(argv[++i]);
+        else if (option == "--threads" && hasValue)
+            numThreads = juce::jmax(1, juce::String(argv[++i]).getIntValue());
+        else if (option == "--list" && hasValue)
+            lists.add(argv[++i]);
+        else if (option.startsWith("--"))
+        {
+            printUsage();
+            return option == "--help" ? 0 : 1;
+        }
+        else
+            inputs.add(option);
+    }
+
+    if (inputs.isEmpty() && lists.isEmpty())
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+
+    for (const auto& input : inputs)
+        if (! addInput(workingDirectory.getChildFile(input), outputDirectory, jobs))
+            return 1;
+
+    for (const auto& list : lists)
+        if (! addInputsFromList(workingDirectory.getChildFile(list), outputDirectory, jobs))
+            return 1;
+
+    if (jobs.empty())
+    {
+        std::printf("No .mml files found\n");
+        return 0;
+    }
+
+    numThreads = juce::jmin(numThreads, static_cast<int>(jobs.size()));
+
+    WorkQueues queues(numThreads, static_cast<juce::uint32>(jobs.size()));
+    std::vector<juce::String> errors(jobs.size()); // One slot per job, so workers never share one
+    std::vector<Statistics> statistics(static_cast<size_t>(numThreads));
+
+    auto runWorker = [&] (int worker)
+    {
+        Converter converter;
+        Statistics& workerStatistics = statistics[static_cast<size_t>(worker)];
+        juce::uint32 job = 0;
+
+        while (queues.next(worker, job))
+        {
+            if (converter.convert(jobs[job], workerStatistics, errors[job]))
+                workerStatistics.converted++;
+            else
+                workerStatistics.failed++;
+        }
+    };
+
+    const double startTime = getSeconds();
+
+    // This thread is the first worker
+    std::vector<std::unique_ptr<WorkerThread>> threads;
+
+    for (int i = 1; i < numThreads; i++)
+    {
+        threads.push_back(std::make_unique<WorkerThread>([&runWorker, i] { runWorker(i); }));
+        threads.back()->startThread();
+    }
+
+    runWorker(0);
+
+    for (auto& thread : threads)
+        thread->waitForThreadToExit(-1);
+
+    const double seconds = juce::jmax(1.0e-9, getSeconds() - startTime);
+
+    for (size_t i = 0; i < jobs.size(); i++)
+        if (errors[i].isNotEmpty())
+            std::fprintf(stderr, "%s: %s\n", jobs[i].input.getFullPathName().toRawUTF8(), errors[i].toRawUTF8());
+
+    Statistics total;
+
+    for (const auto& workerStatistics : statistics)
+        total.add(workerStatistics);
+
+    std::printf("Converted %d of %d files in %.3f s on %d thread(s)", total.converted, static_cast<int>(jobs.size()), seconds, numThreads);
+
+    if (total.failed > 0)
+        std::printf(", %d failed", total.failed);
+
+    std::printf("\n  input   %10.2f MB   %9.2f MB/s\n", static_cast<double>(total.inputBytes) / 1.0e6, static_cast<double>(total.inputBytes) / 1.0e6 / seconds);
+    std::printf("  output  %10.2f MB   %9.2f MB/s\n", static_cast<double>(total.outputBytes) / 1.0e6, static_cast<double>(total.outputBytes) / 1.0e6 / seconds);
+    std::printf("  notes   %10.2f M    %9.2f M notes/s\n", static_cast<double>(total.notes) / 1.0e6, static_cast<double>(total.notes) / 1.0e6 / seconds);
+    std::printf("  files                %9.1f files/s\n", total.converted / seconds);
+    std::printf("  parse %.3f s, write %.3f s (summed over threads), %d steal(s)\n", total.parseSeconds, total.writeSeconds, queues.getNumSteals());
+
+    return total.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,904 @@
+/**
+ * MMLBenchmark - Headless benchmark of the MML parser and MIDI generation
+ *
+ * Generates synthetic scores of a given size and measures, for each one:
+ *  - EnhancedMMLParser::parse() on a new parser and on one that has parsed before (ns/char)
+ *  - generateMidi() and generateEvents() (events/s)
+ *  - MMLLexer::tokenize() with every MMLScanner instruction set the processor supports (MB/s)
+ *  - the same lexer classifying bytes with a character switch instead of its constant table,
+ *    as it did before, so the two can be compared (MB/s and ns/byte)
+ *  - heap allocations made by each of those calls, and the peak resident set size
+ *
+ * Results are printed as a table, and can also be written as JSON to compare releases:
+ *
+ *   MMLBenchmark [--size <bytes>] [--iterations <n>] [--corpus <name>] [--json <file>]
+ *
+ * Timings are the median over the iterations, after one untimed warm-up run.
+ */
+
+#include <JuceHeader.h>
+#include "EnhancedMMLParser.h"
+#include "MMLLexer.h"
+#include "MMLScanner.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__GLIBC__)
+ #define MML_BENCHMARK_COUNTS_ALLOCATIONS 1
+#else
+ #define MML_BENCHMARK_COUNTS_ALLOCATIONS 0
+#endif
+
+//==============================================================================
+// Allocation counting. JUCE containers allocate with malloc and realloc directly, so
+// operator new alone would miss them: on glibc, malloc itself is replaced instead,
+// which also sees every operator new. Elsewhere the counts are reported as unavailable.
+
+namespace
+{
+    std::atomic<juce::uint64> allocationCount { 0 };
+    std::atomic<juce::uint64> allocatedBytes { 0 };
+
+    void countAllocation(size_t size) noexcept
+    {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+#if MML_BENCHMARK_COUNTS_ALLOCATIONS
+extern "C"
+{
+    void* __libc_malloc(size_t size) noexcept;
+    void* __libc_calloc(size_t count, size_t size) noexcept;
+    void* __libc_realloc(void* p, size_t size) noexcept;
+
+    void* malloc(size_t size) noexcept
+    {
+        countAllocation(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) noexcept
+    {
+        countAllocation(count * size);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* p, size_t size) noexcept
+    {
+        countAllocation(size);
+        return __libc_realloc(p, size);
+    }
+}
+#endif
+
+namespace
+{
+    struct AllocationCounts
+    {
+        juce::uint64 count = 0;
+        juce::uint64 bytes = 0;
+    };
+
+    AllocationCounts getAllocationCounts()
+    {
+        return { allocationCount.load(std::memory_order_relaxed), allocatedBytes.load(std::memory_order_relaxed) };
+    }
+
+    //==============================================================================
+    // Peak resident set size. On Linux the peak can be reset, so it is measured per corpus.
+
+    void resetPeakMemory()
+    {
+       #if JUCE_LINUX
+        if (FILE* file = std::fopen("/proc/self/clear_refs", "w"))
+        {
+            std::fputs("5", file);
+            std::fclose(file);
+        }
+       #endif
+    }
+
+    /** @return Peak resident set size in kilobytes, or -1 if it cannot be read. */
+    long getPeakMemoryKB()
+    {
+        long peak = -1;
+
+       #if JUCE_LINUX
+        if (FILE* file = std::fopen("/proc/self/status", "r"))
+        {
+            char line[256];
+
+            while (std::fgets(line, sizeof(line), file) != nullptr)
+                if (std::strncmp(line, "VmHWM:", 6) == 0)
+                    peak = std::strtol(line + 6, nullptr, 10);
+
+            std::fclose(file);
+        }
+       #endif
+
+        return peak;
+    }
+
+    //==============================================================================
+    // Synthetic scores. Each generator appends material until the text reaches the requested size.
+
+    struct Corpus
+    {
+        const char* name;
+        const char* description;
+        std::function<std::string(size_t targetSize, std::mt19937& random)> generate;
+    };
+
+    int randomBetween(std::mt19937& random, int low, int high)
+    {
+        return std::uniform_int_distribution<int>(low, high)(random);
+    }
+
+    char randomNote(std::mt19937& random)
+    {
+        return "cdefgab"[randomBetween(random, 0, 6)];
+    }
+
+    const char* randomLength(std::mt19937& random)
+    {
+        static const char* const lengths[] = { "", "4", "8", "8", "16", "2", "4." };
+        return lengths[randomBetween(random, 0, 6)];
+    }
+
+    // One long track of plain notes, rests and octave changes
+    std::string generateFlat(size_t targetSize, std::mt19937& random)
+    {
+        std::string text = "t132 v100 o4 l8\n";
+        int octaveShift = 0;
+
+        while (text.size() < targetSize)
+        {
+            for (int i = 0; i < 16; i++)
+            {
+                const int choice = randomBetween(random, 0, 9);
+
+                if (choice == 0)
+                    text += 'r';
+                else
+                    text += randomNote(random);
+
+                text += randomLength(random);
+                text += ' ';
+
+                // Octave changes stay within two octaves either way
+                if (choice == 1 && octaveShift < 2)
+                {
+                    text += "> ";
+                    octaveShift++;
+                }
+                else if (choice == 2 && octaveShift > -2)
+                {
+                    text += "< ";
+                    octaveShift--;
+                }
+            }
+
+            text += '\n';
+        }
+
+        return text;
+    }
+
+    // Eight tracks of loops nested six deep (each block of text expands to about 250 notes)
+    std::string generateNestedLoops(size_t targetSize, std::mt19937& random)
+    {
+        constexpr int numTracks = 8;
+        constexpr int depth = 6;
+        const size_t trackSize = targetSize / numTracks + 1;
+        std::string text;
+
+        for (int track = 0; track < numTracks; track++)
+        {
+            const size_t trackStart = text.size();
+            text += "o4 l16 ";
+
+            while (text.size() - trackStart < trackSize)
+            {
+                for (int level = 0; level < depth; level++)
+                {
+                    text += '[';
+                    text += randomNote(random);
+                    text += ' ';
+                    text += randomNote(random);
+                    text += ' ';
+                }
+
+                for (int level = 0; level < depth; level++)
+                    text += "]2 ";
+
+                text += '\n';
+            }
+
+            if (track < numTracks - 1)
+                text += ";\n";
+        }
+
+        return text;
+    }
+
+    // Four tracks with a tempo change before about half of the notes
+    std::string generateTempoChanges(size_t targetSize, std::mt19937& random)
+    {
+        constexpr int numTracks = 4;
+        const size_t trackSize = targetSize / numTracks + 1;
+        std::string text;
+
+        for (int track = 0; track < numTracks; track++)
+        {
+            const size_t trackStart = text.size();
+            text += "o4 l8 ";
+
+            while (text.size() - trackStart < trackSize)
+            {
+                if (randomBetween(random, 0, 1) == 0)
+                {
+                    text += 't';
+                    text += std::to_string(randomBetween(random, 60, 240));
+                    text += ' ';
+                }
+
+                text += randomNote(random);
+                text += randomLength(random);
+                text += ' ';
+
+                if (randomBetween(random, 0, 15) == 0)
+                    text += '\n';
+            }
+
+            if (track < numTracks - 1)
+                text += ";\n";
+        }
+
+        return text;
+    }
+
+    // One track where most notes have accidentals and dots, and about a third are tied
+    std::string generateAccidentalsAndTies(size_t targetSize, std::mt19937& random)
+    {
+        static const char* const accidentals[] = { "", "+", "-", "#" };
+        std::string text = "t120 o4 l8\n";
+
+        while (text.size() < targetSize)
+        {
+            for (int i = 0; i < 12; i++)
+            {
+                const char note = randomNote(random);
+                const char* accidental = accidentals[randomBetween(random, 0, 3)];
+
+                text += note;
+                text += accidental;
+                text += randomLength(random);
+
+                if (randomBetween(random, 0, 2) == 0)
+                {
+                    // Tied to the same pitch
+                    text += "& ";
+                    text += note;
+                    text += accidental;
+                    text += randomLength(random);
+                }
+
+                text += ' ';
+            }
+
+            text += '\n';
+        }
+
+        return text;
+    }
+
+    // Comment text: words of random letters, never containing the end of a block comment
+    void appendCommentText(std::string& text, int numWords, std::mt19937& random)
+    {
+        for (int word = 0; word < numWords; word++)
+        {
+            if (word > 0)
+                text += ' ';
+
+            const int length = randomBetween(random, 2, 9);
+
+            for (int i = 0; i < length; i++)
+                text += static_cast<char>('a' + randomBetween(random, 0, 25));
+        }
+    }
+
+    // A bar of notes after every block comment of 40 to 120 words, with line comments in between
+    std::string generateCommentBlocks(size_t targetSize, std::mt19937& random)
+    {
+        std::string text = "t120 o4 l8\n";
+        int bar = 1;
+
+        while (text.size() < targetSize)
+        {
+            text += "/*\n * ";
+            appendCommentText(text, randomBetween(random, 40, 120), random);
+            text += "\n */\n";
+
+            for (int line = 0; line < 2; line++)
+            {
+                text += "// bar " + std::to_string(bar++) + ": ";
+                appendCommentText(text, randomBetween(random, 6, 16), random);
+                text += '\n';
+
+                for (int i = 0; i < 8; i++)
+                {
+                    text += randomNote(random);
+                    text += ' ';
+                }
+
+                text += '\n';
+            }
+        }
+
+        return text;
+    }
+
+    // Every command padded out to a 48-column field, with indented and blank lines
+    std::string generateColumnPadded(size_t targetSize, std::mt19937& random)
+    {
+        constexpr size_t columnWidth = 48;
+        std::string text = "t120 o4 l8\n";
+
+        while (text.size() < targetSize)
+        {
+            text += "\t\t";
+
+            for (int column = 0; column < 6; column++)
+            {
+                const size_t fieldStart = text.size();
+                text += randomNote(random);
+                text += randomLength(random);
+                text.append(columnWidth - (text.size() - fieldStart), ' ');
+            }
+
+            text += "\n\n";
+        }
+
+        return text;
+    }
+
+    // Bars of notes, each tagged with a 64- to 128-digit number (such as an exported sample
+    // offset or ID) that the parser reads and ignores
+    std::string generateLongNumbers(size_t targetSize, std::mt19937& random)
+    {
+        std::string text = "t120 o4 l8\n";
+
+        while (text.size() < targetSize)
+        {
+            const int numDigits = randomBetween(random, 64, 128);
+            text += static_cast<char>('1' + randomBetween(random, 0, 8));
+
+            for (int i = 1; i < numDigits; i++)
+                text += static_cast<char>('0' + randomBetween(random, 0, 9));
+
+            text += '\n';
+
+            for (int i = 0; i < 8; i++)
+            {
+                text += randomNote(random);
+                text += ' ';
+            }
+
+            text += '\n';
+        }
+
+        return text;
+    }
+
+    //==============================================================================
+    // Reference lexer: MMLLexer::tokenizeRange() as it was before bytes were classified
+    // through a constant table, with a character switch for tokens and a compare chain for
+    // whitespace. Runs are skipped with the same MMLScanner calls, so only the byte
+    // classification differs, and the tokens must come out the same.
+
+    bool isWhitespaceBySwitch(unsigned char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    bool isDigitBySwitch(unsigned char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    void tokenizeWithSwitch(std::string_view source, std::vector<MMLLexer::Token>& tokens)
+    {
+        using TokenType = MMLLexer::TokenType;
+        constexpr size_t shortRunLength = 16;
+
+        const char* const data = source.data();
+        const size_t size = source.size();
+        size_t pos = 0;
+
+        tokens.clear();
+        tokens.reserve(size / 2 + 1);
+
+        auto addToken = [&tokens] (TokenType type, char symbol, size_t offset, size_t length, int value)
+        {
+            tokens.push_back({ type, symbol, static_cast<juce::uint32>(offset), static_cast<juce::uint32>(length), value });
+        };
+
+        while (pos < size)
+        {
+            const unsigned char c = static_cast<unsigned char>(data[pos]);
+
+            if (isWhitespaceBySwitch(c))
+            {
+                const size_t shortRunEnd = std::min(size, pos + 1 + shortRunLength);
+                pos++;
+
+                while (pos < shortRunEnd && isWhitespaceBySwitch(static_cast<unsigned char>(data[pos])))
+                    pos++;
+
+                if (pos == shortRunEnd)
+                    pos = MMLScanner::skipWhitespace(data, pos, size);
+
+                continue;
+            }
+
+            if (isDigitBySwitch(c))
+            {
+                const size_t start = pos;
+                int value = 0;
+
+                while (pos < size && isDigitBySwitch(static_cast<unsigned char>(data[pos])))
+                {
+                    if (value > (MMLLexer::maxNumberValue - 9) / 10)
+                    {
+                        value = MMLLexer::maxNumberValue;
+                        pos = MMLScanner::skipDigits(data, pos, size);
+                        break;
+                    }
+
+                    value = value * 10 + (data[pos] - '0');
+                    pos++;
+                }
+
+                addToken(TokenType::Number, static_cast<char>(c), start, pos - start, value);
+                continue;
+            }
+
+            if (c == '/' && pos + 1 < size && (data[pos + 1] == '/' || data[pos + 1] == '*'))
+            {
+                if (data[pos + 1] == '/')
+                {
+                    pos = MMLScanner::findEither(data, pos + 2, size, '\n', '\n');
+                }
+                else
+                {
+                    const size_t end = MMLScanner::findBlockCommentEnd(data, pos + 2, size);
+                    pos = end < size ? end + 2 : size;
+                }
+
+                continue;
+            }
+
+            switch (c)
+            {
+                case 'c': case 'd': case 'e': case 'f': case 'g': case 'a': case 'b':
+                    addToken(TokenType::Note, static_cast<char>(c), pos, 1, 0);
+                    break;
+
+                case 'r': addToken(TokenType::Rest, 'r', pos, 1, 0); break;
+                case 'o': addToken(TokenType::Octave, 'o', pos, 1, 0); break;
+                case '>': addToken(TokenType::OctaveUp, '>', pos, 1, 0); break;
+                case '<': addToken(TokenType::OctaveDown, '<', pos, 1, 0); break;
+                case 'l': addToken(TokenType::Length, 'l', pos, 1, 0); break;
+                case 't': addToken(TokenType::Tempo, 't', pos, 1, 0); break;
+                case 'v': addToken(TokenType::Volume, 'v', pos, 1, 0); break;
+                case '[': addToken(TokenType::LoopBegin, '[', pos, 1, 0); break;
+                case ']': addToken(TokenType::LoopEnd, ']', pos, 1, 0); break;
+                case '{': addToken(TokenType::TupletBegin, '{', pos, 1, 0); break;
+                case '}': addToken(TokenType::TupletEnd, '}', pos, 1, 0); break;
+                case '+': case '#': addToken(TokenType::Sharp, static_cast<char>(c), pos, 1, 0); break;
+                case '-': addToken(TokenType::Flat, '-', pos, 1, 0); break;
+                case '.': addToken(TokenType::Dot, '.', pos, 1, 0); break;
+                case '&': case '^': addToken(TokenType::Tie, static_cast<char>(c), pos, 1, 0); break;
+                case '*': addToken(TokenType::Star, '*', pos, 1, 0); break;
+                default: break; // Not part of the grammar - ignored
+            }
+
+            pos++;
+        }
+    }
+
+    bool isSameTokens(const std::vector<MMLLexer::Token>& a, const std::vector<MMLLexer::Token>& b)
+    {
+        return std::equal(a.begin(), a.end(), b.begin(), b.end(), [] (const MMLLexer::Token& x, const MMLLexer::Token& y)
+        {
+            return x.type == y.type && x.symbol == y.symbol && x.offset == y.offset && x.length == y.length && x.value == y.value;
+        });
+    }
+
+    //==============================================================================
+    // Measurement
+
+    struct Timing
+    {
+        double median = 0.0;
+        double min = 0.0;
+    };
+
+    struct Measurement
+    {
+        Timing seconds;
+        AllocationCounts allocationsPerRun; // From the last run
+    };
+
+    double getSeconds()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    Timing summarize(std::vector<double> samples)
+    {
+        std::sort(samples.begin(), samples.end());
+        return { samples[samples.size() / 2], samples.front() };
+    }
+
+    /**
+     * Times a function over a number of runs, after one untimed warm-up run.
+     * @param iterations Number of timed runs.
+     * @param prepare Called untimed before each run (may be empty).
+     * @param run The function to time.
+     */
+    Measurement measure(int iterations, const std::function<void()>& prepare, const std::function<void()>& run)
+    {
+        std::vector<double> samples;
+        AllocationCounts allocations;
+
+        for (int i = -1; i < iterations; i++)
+        {
+            if (prepare)
+                prepare();
+
+            const AllocationCounts before = getAllocationCounts();
+            const double start = getSeconds();
+            run();
+            const double elapsed = getSeconds() - start;
+            const AllocationCounts after = getAllocationCounts();
+
+            if (i < 0)
+                continue;
+
+            samples.push_back(elapsed);
+            allocations = { after.count - before.count, after.bytes - before.bytes };
+        }
+
+        return { summarize(std::move(samples)), allocations };
+    }
+
+    const char* getInstructionSetName(MMLScanner::InstructionSet instructionSet)
+    {
+        switch (instructionSet)
+        {
+            case MMLScanner::InstructionSet::AVX2: return "avx2";
+            case MMLScanner::InstructionSet::SSE2: return "sse2";
+            case MMLScanner::InstructionSet::Scalar: break;
+        }
+
+        return "scalar";
+    }
+
+    struct CorpusResult
+    {
+        std::string name;
+        std::string description;
+        size_t bytes = 0;
+        int numTracks = 0;
+        bool expanded = false;
+        size_t numEvents = 0;
+        Measurement parseNew;  // First parse on a new parser
+        Measurement parseWarm; // Parser that has parsed the score before
+        Measurement generateMidi;
+        Measurement generateEvents;
+        std::vector<std::pair<MMLScanner::InstructionSet, Timing>> tokenize;
+        Timing tokenizeTable;  // Best instruction set, measured next to tokenizeSwitch
+        Timing tokenizeSwitch; // Reference lexer with a character switch
+        long peakMemoryKB = -1;
+    };
+
+    bool runCorpus(const Corpus& corpus, size_t targetSize, int iterations, CorpusResult& result)
+    {
+        resetPeakMemory();
+
+        std::mt19937 random(20240601);
+        const std::string text = corpus.generate(targetSize, random);
+        const std::string_view source(text);
+
+        result.name = corpus.name;
+        result.description = corpus.description;
+        result.bytes = text.size();
+
+        std::unique_ptr<EnhancedMMLParser> parser;
+        bool succeeded = true;
+
+        result.parseNew = measure(iterations,
+                                  [&] { parser = std::make_unique<EnhancedMMLParser>(); },
+                                  [&] { succeeded = parser->parse(source) && succeeded; });
+
+        result.parseWarm = measure(iterations, nullptr, [&] { succeeded = parser->parse(source) && succeeded; });
+
+        if (! succeeded)
+        {
+            std::fprintf(stderr, "%s: %s\n", corpus.name, parser->getError().toRawUTF8());
+            return false;
+        }
+
+        result.numTracks = parser->getNumTracks();
+        result.expanded = parser->isExpanded();
+
+        juce::MidiMessageSequence sequence;
+        result.generateMidi = measure(iterations, [&] { sequence.clear(); }, [&] { sequence = parser->generateMidi(); });
+        result.numEvents = static_cast<size_t>(sequence.getNumEvents());
+
+        std::vector<MMLMidiEvent> events;
+        result.generateEvents = measure(iterations, nullptr, [&] { parser->generateEvents(events); });
+
+        std::vector<MMLLexer::Token> tokens;
+        const auto bestInstructionSet = MMLScanner::getBestSupportedInstructionSet();
+
+        for (auto instructionSet : { MMLScanner::InstructionSet::Scalar, MMLScanner::InstructionSet::SSE2, MMLScanner::InstructionSet::AVX2 })
+        {
+            if (instructionSet > bestInstructionSet)
+                break;
+
+            MMLScanner::setInstructionSet(instructionSet);
+            result.tokenize.push_back({ instructionSet, measure(iterations, nullptr, [&] { MMLLexer::tokenize(source, tokens); }).seconds });
+        }
+
+        MMLScanner::setInstructionSet(bestInstructionSet);
+
+        // Byte classification: constant table (MMLLexer) against a character switch
+        std::vector<MMLLexer::Token> switchTokens;
+        MMLLexer::tokenize(source, tokens);
+        tokenizeWithSwitch(source, switchTokens);
+
+        if (! isSameTokens(tokens, switchTokens))
+        {
+            std::fprintf(stderr, "%s: the reference switch lexer disagrees with MMLLexer\n", corpus.name);
+            return false;
+        }
+
+        result.tokenizeTable = measure(iterations, nullptr, [&] { MMLLexer::tokenize(source, tokens); }).seconds;
+        result.tokenizeSwitch = measure(iterations, nullptr, [&] { tokenizeWithSwitch(source, switchTokens); }).seconds;
+
+        parser.reset();
+        result.peakMemoryKB = getPeakMemoryKB();
+        return true;
+    }
+
+    //==============================================================================
+    // Reporting
+
+    double nanosecondsPerChar(const Timing& timing, size_t bytes)
+    {
+        return timing.median * 1.0e9 / static_cast<double>(bytes);
+    }
+
+    double perSecond(size_t count, const Timing& timing)
+    {
+        return timing.median > 0.0 ? static_cast<double>(count) / timing.median : 0.0;
+    }
+
+    void printResult(const CorpusResult& result)
+    {
+        std::printf("\n%s - %s\n", result.name.c_str(), result.description.c_str());
+        std::printf("  %zu bytes, %d track(s), %zu events%s\n", result.bytes, result.numTracks, result.numEvents,
+                    result.expanded ? "" : " (too long to expand: played from bytecode)");
+
+        auto printAllocations = [] (const Measurement& measurement)
+        {
+           #if MML_BENCHMARK_COUNTS_ALLOCATIONS
+            std::printf("  %8llu allocs  %10llu bytes", static_cast<unsigned long long>(measurement.allocationsPerRun.count),
+                        static_cast<unsigned long long>(measurement.allocationsPerRun.bytes));
+           #else
+            juce::ignoreUnused(measurement);
+           #endif
+        };
+
+        std::printf("  parse (new parser)    %9.2f ns/char  %9.2f MB/s", nanosecondsPerChar(result.parseNew.seconds, result.bytes),
+                    perSecond(result.bytes, result.parseNew.seconds) / 1.0e6);
+        printAllocations(result.parseNew);
+        std::printf("\n  parse (warm parser)   %9.2f ns/char  %9.2f MB/s", nanosecondsPerChar(result.parseWarm.seconds, result.bytes),
+                    perSecond(result.bytes, result.parseWarm.seconds) / 1.0e6);
+        printAllocations(result.parseWarm);
+        std::printf("\n  generateMidi          %9.2f M events/s         ", perSecond(result.numEvents, result.generateMidi.seconds) / 1.0e6);
+        printAllocations(result.generateMidi);
+        std::printf("\n  generateEvents        %9.2f M events/s         ", perSecond(result.numEvents, result.generateEvents.seconds) / 1.0e6);
+        printAllocations(result.generateEvents);
+        std::printf("\n");
+
+        for (const auto& [instructionSet, timing] : result.tokenize)
+            std::printf("  tokenize (%-6s)     %9.2f MB/s\n", getInstructionSetName(instructionSet), perSecond(result.bytes, timing) / 1.0e6);
+
+        std::printf("  tokenize (table)      %9.2f MB/s    %9.2f ns/byte\n", perSecond(result.bytes, result.tokenizeTable) / 1.0e6,
+                    nanosecondsPerChar(result.tokenizeTable, result.bytes));
+        std::printf("  tokenize (switch)     %9.2f MB/s    %9.2f ns/byte\n", perSecond(result.bytes, result.tokenizeSwitch) / 1.0e6,
+                    nanosecondsPerChar(result.tokenizeSwitch, result.bytes));
+
+        if (result.peakMemoryKB >= 0)
+            std::printf("  peak RSS              %9.2f MB\n", static_cast<double>(result.peakMemoryKB) / 1024.0);
+    }
+
+    void writeTiming(std::ofstream& out, const char* name, const Timing& timing, const char* separator)
+    {
+        out << "        \"" << name << "\": { \"median\": " << timing.median << ", \"min\": " << timing.min << " }" << separator << "\n";
+    }
+
+    void writeMeasurement(std::ofstream& out, const char* name, const Measurement& measurement, const char* rateName, double rate)
+    {
+        out << "      \"" << name << "\": {\n";
+        out << "        \"" << rateName << "\": " << rate << ",\n";
+        writeTiming(out, "seconds", measurement.seconds, ",");
+
+       #if MML_BENCHMARK_COUNTS_ALLOCATIONS
+        out << "        \"allocations\": " << measurement.allocationsPerRun.count << ",\n";
+        out << "        \"allocatedBytes\": " << measurement.allocationsPerRun.bytes << "\n";
+       #else
+        out << "        \"allocations\": null,\n";
+        out << "        \"allocatedBytes\": null\n";
+       #endif
+
+        out << "      },\n";
+    }
+
+    bool writeJson(const juce::String& path, const std::vector<CorpusResult>& results, size_t targetSize, int iterations)
+    {
+        std::ofstream out(path.toStdString());
+
+        if (! out)
+            return false;
+
+        out.precision(9);
+        out << "{\n";
+        out << "  \"schemaVersion\": 1,\n";
+        out << "  \"juceVersion\": \"" << juce::SystemStats::getJUCEVersion() << "\",\n";
+        out << "  \"operatingSystem\": \"" << juce::SystemStats::getOperatingSystemName() << "\",\n";
+        out << "  \"numCpus\": " << juce::SystemStats::getNumCpus() << ",\n";
+        out << "  \"instructionSet\": \"" << getInstructionSetName(MMLScanner::getBestSupportedInstructionSet()) << "\",\n";
+        out << "  \"targetSize\": " << targetSize << ",\n";
+        out << "  \"iterations\": " << iterations << ",\n";
+        out << "  \"corpora\": [\n";
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const CorpusResult& result = results[i];
+
+            out << "    {\n";
+            out << "      \"name\": \"" << result.name << "\",\n";
+            out << "      \"bytes\": " << result.bytes << ",\n";
+            out << "      \"tracks\": " << result.numTracks << ",\n";
+            out << "      \"expanded\": " << (result.expanded ? "true" : "false") << ",\n";
+            out << "      \"events\": " << result.numEvents << ",\n";
+            writeMeasurement(out, "parseNew", result.parseNew, "nsPerChar", nanosecondsPerChar(result.parseNew.seconds, result.bytes));
+            writeMeasurement(out, "parseWarm", result.parseWarm, "nsPerChar", nanosecondsPerChar(result.parseWarm.seconds, result.bytes));
+            writeMeasurement(out, "generateMidi", result.generateMidi, "eventsPerSecond", perSecond(result.numEvents, result.generateMidi.seconds));
+            writeMeasurement(out, "generateEvents", result.generateEvents, "eventsPerSecond", perSecond(result.numEvents, result.generateEvents.seconds));
+
+            out << "      \"tokenizeMBPerSecond\": {";
+
+            for (size_t j = 0; j < result.tokenize.size(); j++)
+                out << (j == 0 ? " " : ", ") << "\"" << getInstructionSetName(result.tokenize[j].first) << "\": "
+                    << perSecond(result.bytes, result.tokenize[j].second) / 1.0e6;
+
+            out << " },\n";
+            out << "      \"tokenizeTableNsPerByte\": " << nanosecondsPerChar(result.tokenizeTable, result.bytes) << ",\n";
+            out << "      \"tokenizeSwitchNsPerByte\": " << nanosecondsPerChar(result.tokenizeSwitch, result.bytes) << ",\n";
+
+            if (result.peakMemoryKB >= 0)
+                out << "      \"peakRssKB\": " << result.peakMemoryKB << "\n";
+            else
+                out << "      \"peakRssKB\": null\n";
+
+            out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+
+        out << "  ]\n";
+        out << "}\n";
+        return static_cast<bool>(out);
+    }
+
+    void printUsage()
+    {
+        std::printf("Usage: MMLBenchmark [--size <bytes>] [--iterations <n>] [--corpus <name>] [--json <file>]\n"
+                    "  --size        Size of each generated score in bytes (default 262144)\n"
+                    "  --iterations  Timed runs of each measurement (default 10)\n"
+                    "  --corpus      Only run the named corpus (flat, nested-loops, tempo-changes, accidentals-ties,\n"
+                    "                comment-blocks, column-padded, long-numbers)\n"
+                    "  --json        Also write the results to this file as JSON\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    const Corpus corpora[] = {
+        { "flat", "one long track of notes, rests and octave changes", generateFlat },
+        { "nested-loops", "8 tracks of loops nested 6 deep", generateNestedLoops },
+        { "tempo-changes", "4 tracks, a tempo change before half of the notes", generateTempoChanges },
+        { "accidentals-ties", "accidentals, dots and tied notes", generateAccidentalsAndTies },
+        { "comment-blocks", "short bars between long block and line comments", generateCommentBlocks },
+        { "column-padded", "commands padded with spaces to fixed-width columns", generateColumnPadded },
+        { "long-numbers", "bars tagged with 64- to 128-digit numbers", generateLongNumbers }
+    };
+
+    size_t targetSize = 256 * 1024;
+    int iterations = 10;
+    juce::String corpusName;
+    juce::String jsonPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const juce::String option(argv[i]);
+        const bool hasValue = i + 1 < argc;
+
+        if (option == "--size" && hasValue)
+            targetSize = static_cast<size_t>(juce::jmax(1, juce::String(argv[++i]).getIntValue()));
+        else if (option == "--iterations" && hasValue)
+            iterations = juce::jmax(1, juce::String(argv[++i]).getIntValue());
+        else if (option == "--corpus" && hasValue)
+            corpusName = argv[++i];
+        else if (option == "--json" && hasValue)
+            jsonPath = argv[++i];
+        else
+        {
+            printUsage();
+            return option == "--help" ? 0 : 1;
+        }
+    }
+
+    std::printf("MMLBenchmark: %zu-byte scores, %d iterations, scanner %s\n", targetSize, iterations,
+                getInstructionSetName(MMLScanner::getBestSupportedInstructionSet()));
+
+   #if ! MML_BENCHMARK_COUNTS_ALLOCATIONS
+    std::printf("(allocation counts are only available with glibc)\n");
+   #endif
+
+    std::vector<CorpusResult> results;
+
+    for (const Corpus& corpus : corpora)
+    {
+        if (corpusName.isNotEmpty() && corpusName != corpus.name)
+            continue;
+
+        CorpusResult result;
+
+        if (! runCorpus(corpus, targetSize, iterations, result))
+            return 1;
+
+        printResult(result);
+        results.push_back(std::move(result));
+    }
+
+    if (results.empty())
+    {
+        std::fprintf(stderr, "Unknown corpus: %s\n", corpusName.toRawUTF8());
+        return 1;
+    }
+
+    if (jsonPath.isNotEmpty() && ! writeJson(jsonPath, results, targetSize, iterations))
+    {
+        std::fprintf(stderr, "Could not write %s\n", jsonPath.toRawUTF8());
+        return 1;
+    }
+
+    return 0;
+}
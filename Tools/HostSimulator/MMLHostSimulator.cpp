@@ -0,0 +1,667 @@
+/**
+ * MMLHostSimulator - Offline host that measures MMLPluginProcessor::processBlock()
+ *
+ * Runs the plugin processor the way a DAW would, without an audio device. For
+ * every combination of sample rate (44.1 to 192 kHz) and block size (16 to 4096
+ * samples, plus a run where each block has a different size), a scripted
+ * transport plays the score with locates, cycles switched on and off, host tempo
+ * changes, and stops with a preview in between. Each combination reports:
+ *  - processBlock() time per block: p50, p99, p99.9 and maximum, and the worst
+ *    block as a share of the real time it covers
+ *  - MIDI events written per block
+ *  - note-ons that came out late, were dropped, or were not in the score, found by
+ *    comparing every playing block with the score as MMLEventStream plays it
+ *
+ *   MMLHostSimulator [--seconds <s>] [--score <file.mml>] [--seed <n>]
+ *
+ * Blocks run back to back, as in an offline bounce, so the timings are the cost of
+ * processBlock() alone. The exit code is 1 if any note-on was late, dropped or unexpected.
+ */
+
+#include <JuceHeader.h>
+#include "MMLPluginProcessor.h"
+#include "EnhancedMMLParser.h"
+#include "MMLEventStream.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr double sampleRates[] = { 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0 };
+
+    constexpr int maxBlockSize = 4096;
+    constexpr int minBlockSize = 16;
+    constexpr int variedBlockSize = 0; // Each block gets a random size between minBlockSize and maxBlockSize
+    constexpr int blockSizes[] = { 16, 64, 256, 1024, 4096, variedBlockSize };
+
+    // A quarter note is a whole number of samples at every rate above with these
+    // tempos, so cycle points land on exact samples for the host and the plugin alike
+    constexpr double hostTempos[] = { 90.0, 120.0, 150.0 };
+
+    int randomBetween(std::mt19937& random, int low, int high)
+    {
+        return std::uniform_int_distribution<int>(low, high)(random);
+    }
+
+    //==============================================================================
+    // Built-in scores
+
+    struct Score
+    {
+        std::string name;
+        std::string text;
+    };
+
+    // Eight tracks of a few minutes each, with tempo changes, accidentals, ties, loops and tuplets (expanded)
+    std::string makeArrangementScore()
+    {
+        static const char* const phrases[] = {
+            "c e g > c < g e ", "d f+ a > d < a f+ ", "e- g b- > e- < b- g ", "[c d e f]2 ",
+            "{c e g}4 {d f a}4 ", "c8. d16 e8& e16 f16 ", "g4& g8 a8 b-4 ", "r8 c+8 d+8 r8 "
+        };
+
+        std::mt19937 random(1234);
+        std::string text;
+
+        for (int track = 0; track < 8; track++)
+        {
+            text += "o" + std::to_string(3 + track % 3) + (track % 2 == 0 ? " l8 " : " l16 ");
+
+            for (int bar = 0; bar < 96; bar++)
+            {
+                // The first track carries the tempo changes, every four bars
+                if (track == 0 && bar % 4 == 0)
+                    text += "t" + std::to_string(randomBetween(random, 80, 200)) + " ";
+
+                text += phrases[randomBetween(random, 0, 7)];
+            }
+
+            text += track < 7 ? ";\n" : "\n";
+        }
+
+        return text;
+    }
+
+    // One track of over a million notes, played from bytecode through the seek table (streamed)
+    std::string makeLongScore()
+    {
+        return "t150 o4 l16 [[[c d e f g a b > c <]100 ]100 ]13\n";
+    }
+
+    //==============================================================================
+    // Expected output
+
+    /** A note-on at its place on the host timeline and its sample offset in the block it belongs to. */
+    struct NoteOn
+    {
+        juce::int64 samplePosition;
+        int blockOffset;
+        juce::uint8 status;
+        juce::uint8 noteNumber;
+
+        bool operator< (const NoteOn& other) const
+        {
+            if (samplePosition != other.samplePosition)
+                return samplePosition < other.samplePosition;
+
+            if (status != other.status)
+                return status < other.status;
+
+            return noteNumber < other.noteNumber;
+        }
+    };
+
+    /** Every note-on of a score at one sample rate, in timeline order, and where the last event falls. */
+    struct Reference
+    {
+        std::vector<NoteOn> noteOns;
+        juce::int64 length = 0;
+    };
+
+    void buildReference(const std::vector<MMLProgram>& programs, double sampleRate, Reference& reference)
+    {
+        reference.noteOns.clear();
+        reference.length = 0;
+
+        MMLEventStream stream;
+        stream.setTracks(programs.data(), static_cast<int>(programs.size()), sampleRate);
+
+        for (; ! stream.isFinished(); stream.advance())
+        {
+            const MMLMidiEvent& event = stream.getEvent();
+            reference.length = stream.getSamplePosition();
+
+            if (event.isNoteOn())
+                reference.noteOns.push_back({ stream.getSamplePosition(), 0, event.data[0], event.data[1] });
+        }
+
+        // Note-ons at the same sample come from different tracks; order them as NoteOn compares
+        std::sort(reference.noteOns.begin(), reference.noteOns.end());
+    }
+
+    //==============================================================================
+    // Host transport
+
+    /** The part of the host timeline one block covers. */
+    struct BlockPlan
+    {
+        bool isPlaying = false;
+        bool stopped = false;       // The transport stopped at this block: the simulator starts a preview, as the Send button does
+        int numSamples = 0;
+        juce::int64 start = 0;      // Timeline position of the first sample
+        int samplesBeforeWrap = 0;  // Equal to numSamples unless the cycle wraps inside the block
+        juce::int64 wrapStart = 0;  // Where the timeline continues after the wrap
+    };
+
+    /**
+     * Plays the part of the host: a transport that runs on its own for a random second
+     * or two at a time, then locates, switches the cycle on or off, changes tempo, or
+     * stops for a moment. The script only depends on the seed, so runs are repeatable.
+     */
+    class ScriptedTransport : public juce::AudioPlayHead
+    {
+    public:
+        ScriptedTransport(double sampleRateToUse, juce::int64 locateRange, unsigned seed)
+            : random(seed), sampleRate(sampleRateToUse), range(juce::jmax(juce::int64(1), locateRange))
+        {
+            scheduleNextAction();
+        }
+
+        /** Moves to the next block, runs any action that is due, and describes the block. */
+        BlockPlan nextBlock(int numSamples)
+        {
+            BlockPlan plan;
+
+            if (samplesUntilAction <= 0)
+            {
+                plan.stopped = runAction();
+                scheduleNextAction();
+            }
+
+            samplesUntilAction -= numSamples;
+
+            position = {};
+            position.setIsPlaying(playing);
+            position.setTimeInSamples(timelinePosition);
+            position.setTimeInSeconds(static_cast<double>(timelinePosition) / sampleRate);
+            position.setPpqPosition(static_cast<double>(timelinePosition) / static_cast<double>(samplesPerQuarter()));
+            position.setBpm(tempo);
+            position.setIsLooping(looping);
+
+            if (looping)
+                position.setLoopPoints(juce::AudioPlayHead::LoopPoints { static_cast<double>(loopStartQuarter), static_cast<double>(loopEndQuarter) });
+
+            plan.isPlaying = playing;
+            plan.numSamples = numSamples;
+            plan.start = timelinePosition;
+            plan.samplesBeforeWrap = numSamples;
+
+            if (playing)
+            {
+                const juce::int64 loopEnd = loopEndQuarter * samplesPerQuarter();
+
+                if (looping && timelinePosition < loopEnd && timelinePosition + numSamples > loopEnd)
+                {
+                    // The cycle end falls inside the block; the next block reports the position after the wrap
+                    plan.samplesBeforeWrap = static_cast<int>(loopEnd - timelinePosition);
+                    plan.wrapStart = loopStartQuarter * samplesPerQuarter();
+                    timelinePosition = plan.wrapStart + (numSamples - plan.samplesBeforeWrap);
+                }
+                else
+                {
+                    timelinePosition += numSamples;
+                }
+            }
+
+            return plan;
+        }
+
+        juce::Optional<PositionInfo> getPosition() const override
+        {
+            return position;
+        }
+
+    private:
+        juce::int64 samplesPerQuarter() const
+        {
+            return static_cast<juce::int64>(sampleRate * 60.0 / tempo);
+        }
+
+        void scheduleNextAction()
+        {
+            // Stops are short; otherwise the transport plays for half a second to three seconds
+            const double seconds = playing ? randomBetween(random, 500, 3000) / 1000.0 : randomBetween(random, 250, 1000) / 1000.0;
+            samplesUntilAction = static_cast<juce::int64>(seconds * sampleRate);
+        }
+
+        /** @return True if the transport stopped. */
+        bool runAction()
+        {
+            if (! playing)
+            {
+                playing = true;
+                return false;
+            }
+
+            const int choice = randomBetween(random, 0, 99);
+
+            if (choice < 30)
+            {
+                // Locate anywhere, including past the end of the score
+                timelinePosition = std::uniform_int_distribution<juce::int64>(0, range - 1)(random);
+            }
+            else if (choice < 50)
+            {
+                // Cycle the bars around the current position
+                loopStartQuarter = juce::jmax(juce::int64(0), timelinePosition / samplesPerQuarter() - randomBetween(random, 0, 4));
+                loopEndQuarter = timelinePosition / samplesPerQuarter() + randomBetween(random, 1, 8);
+                looping = true;
+            }
+            else if (choice < 65)
+            {
+                looping = false;
+            }
+            else if (choice < 85)
+            {
+                // The timeline keeps its sample position, so the position in quarter notes moves
+                tempo = hostTempos[randomBetween(random, 0, 2)];
+            }
+            else
+            {
+                playing = false;
+                return true;
+            }
+
+            return false;
+        }
+
+        std::mt19937 random;
+        const double sampleRate;
+        const juce::int64 range;
+        juce::int64 samplesUntilAction = 0;
+        juce::int64 timelinePosition = 0;
+        double tempo = hostTempos[1];
+        bool playing = true;
+        bool looping = false;
+        juce::int64 loopStartQuarter = 0;
+        juce::int64 loopEndQuarter = 0;
+        PositionInfo position;
+    };
+
+    //==============================================================================
+    // Checking
+
+    struct NoteCounts
+    {
+        juce::int64 late = 0;       // Written after the block the score puts them in, or later in the right block
+        juce::int64 dropped = 0;    // Never written
+        juce::int64 unexpected = 0; // Written but not in the score at that place
+    };
+
+    /**
+     * Compares the note-ons written in each playing block with the score. A note-on that
+     * is missing from its block but turns up later in the block or in the next one is
+     * counted as late rather than as dropped and unexpected. All storage is reserved up
+     * front, so checking does not allocate between blocks.
+     */
+    class NoteChecker
+    {
+    public:
+        explicit NoteChecker(const Reference& referenceToUse)
+            : reference(referenceToUse)
+        {
+            for (auto* notes : { &expected, &written, &missing, &extra, &pending })
+                notes->reserve(maxNotesPerBlock);
+        }
+
+        void checkBlock(const BlockPlan& plan, const juce::MidiBuffer& midiMessages, NoteCounts& counts)
+        {
+            // Notes still missing from the last block can only turn up late if the timeline carried straight on
+            if (! plan.isPlaying || plan.start != expectedStart)
+            {
+                counts.dropped += static_cast<juce::int64>(pending.size());
+                pending.clear();
+            }
+
+            if (! plan.isPlaying)
+            {
+                expectedStart = -1;
+                return;
+            }
+
+            expected.clear();
+            addExpected(plan.start, plan.samplesBeforeWrap, 0);
+
+            if (plan.samplesBeforeWrap < plan.numSamples)
+                addExpected(plan.wrapStart, plan.numSamples - plan.samplesBeforeWrap, plan.samplesBeforeWrap);
+
+            written.clear();
+
+            for (const auto metadata : midiMessages)
+            {
+                const juce::uint8* data = metadata.data;
+
+                if (metadata.numBytes < 3 || (data[0] & 0xf0) != 0x90 || data[2] == 0 || written.size() == written.capacity())
+                    continue;
+
+                const int offset = metadata.samplePosition;
+                const juce::int64 samplePosition = offset < plan.samplesBeforeWrap ? plan.start + offset
+                                                                                   : plan.wrapStart + (offset - plan.samplesBeforeWrap);
+                written.push_back({ samplePosition, offset, data[0], data[1] });
+            }
+
+            std::sort(expected.begin(), expected.end());
+            std::sort(written.begin(), written.end());
+
+            missing.clear();
+            extra.clear();
+            std::set_difference(expected.begin(), expected.end(), written.begin(), written.end(), std::back_inserter(missing));
+            std::set_difference(written.begin(), written.end(), expected.begin(), expected.end(), std::back_inserter(extra));
+
+            for (const NoteOn& note : extra)
+            {
+                if (takeEarlier(pending, note) || takeEarlier(missing, note))
+                    counts.late++;
+                else
+                    counts.unexpected++;
+            }
+
+            counts.dropped += static_cast<juce::int64>(pending.size());
+            pending.clear();
+
+            // Whatever is still missing may come out at the start of the next block
+            for (NoteOn note : missing)
+            {
+                note.blockOffset -= plan.numSamples;
+                pending.push_back(note);
+            }
+
+            expectedStart = plan.samplesBeforeWrap < plan.numSamples ? plan.wrapStart + (plan.numSamples - plan.samplesBeforeWrap)
+                                                                     : plan.start + plan.numSamples;
+        }
+
+        /** Counts the notes that were still missing when the run ended. */
+        void finish(NoteCounts& counts)
+        {
+            counts.dropped += static_cast<juce::int64>(pending.size());
+            pending.clear();
+        }
+
+    private:
+        // More note-ons than this in one block (4096 samples) are beyond any score worth playing
+        static constexpr size_t maxNotesPerBlock = 16384;
+
+        void addExpected(juce::int64 start, int numSamples, int blockOffset)
+        {
+            const auto& notes = reference.noteOns;
+            auto first = std::lower_bound(notes.begin(), notes.end(), start,
+                                          [] (const NoteOn& note, juce::int64 position) { return note.samplePosition < position; });
+
+            for (auto it = first; it != notes.end() && it->samplePosition < start + numSamples && expected.size() < expected.capacity(); ++it)
+                expected.push_back({ it->samplePosition, blockOffset + static_cast<int>(it->samplePosition - start), it->status, it->noteNumber });
+        }
+
+        /** Removes a missing note with the same status and number that was due before the written one. */
+        static bool takeEarlier(std::vector<NoteOn>& notes, const NoteOn& writtenNote)
+        {
+            for (auto it = notes.begin(); it != notes.end(); ++it)
+            {
+                if (it->status == writtenNote.status && it->noteNumber == writtenNote.noteNumber && it->blockOffset < writtenNote.blockOffset)
+                {
+                    notes.erase(it);
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        const Reference& reference;
+        std::vector<NoteOn> expected, written, missing, extra, pending;
+        juce::int64 expectedStart = -1;
+    };
+
+    //==============================================================================
+    // Simulation
+
+    struct RunResult
+    {
+        double sampleRate = 0.0;
+        int blockSize = 0;
+        size_t numBlocks = 0;
+        double p50 = 0.0, p99 = 0.0, p999 = 0.0, max = 0.0; // Microseconds
+        double worstBudgetShare = 0.0;  // Largest block time over the real time the block covers
+        double meanEventsPerBlock = 0.0;
+        int maxEventsPerBlock = 0;
+        NoteCounts notes;
+    };
+
+    double percentile(const std::vector<double>& sortedValues, double fraction)
+    {
+        const size_t rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sortedValues.size())));
+        return sortedValues[juce::jlimit(size_t(1), sortedValues.size(), rank) - 1];
+    }
+
+    RunResult simulate(MMLPlugin::MMLPluginProcessor& processor, const Reference& reference,
+                       double sampleRate, int blockSize, double seconds, unsigned seed)
+    {
+        RunResult result;
+        result.sampleRate = sampleRate;
+        result.blockSize = blockSize;
+
+        processor.setRateAndBufferSizeDetails(sampleRate, maxBlockSize);
+        processor.prepareToPlay(sampleRate, maxBlockSize);
+
+        // Locates reach up to two seconds past the last event
+        ScriptedTransport transport(sampleRate, reference.length + static_cast<juce::int64>(2.0 * sampleRate), seed);
+        processor.setPlayHead(&transport);
+
+        NoteChecker checker(reference);
+        std::mt19937 random(seed);
+
+        // Everything the host hands to processBlock() is allocated here, once
+        const int numChannels = juce::jmax(processor.getTotalNumInputChannels(), processor.getTotalNumOutputChannels());
+        juce::AudioBuffer<float> audioStorage(numChannels, maxBlockSize);
+        juce::MidiBuffer midiMessages;
+        midiMessages.ensureSize(64 * 1024);
+
+        const juce::int64 totalSamples = static_cast<juce::int64>(seconds * sampleRate);
+        std::vector<double> microseconds;
+        microseconds.reserve(static_cast<size_t>(totalSamples / minBlockSize + 1));
+        juce::int64 totalEvents = 0;
+
+        for (juce::int64 done = 0; done < totalSamples;)
+        {
+            const int numSamples = blockSize == variedBlockSize ? randomBetween(random, minBlockSize, maxBlockSize) : blockSize;
+            const BlockPlan plan = transport.nextBlock(numSamples);
+
+            if (plan.stopped)
+                processor.sendMidiToTrack();
+
+            juce::AudioBuffer<float> audio(audioStorage.getArrayOfWritePointers(), numChannels, numSamples);
+            midiMessages.clear();
+
+            const auto start = std::chrono::steady_clock::now();
+            processor.processBlock(audio, midiMessages);
+            const auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+            microseconds.push_back(elapsed);
+            result.worstBudgetShare = juce::jmax(result.worstBudgetShare, elapsed * 1.0e-6 * sampleRate / numSamples);
+
+            const int numEvents = midiMessages.getNumEvents();
+            totalEvents += numEvents;
+            result.maxEventsPerBlock = juce::jmax(result.maxEventsPerBlock, numEvents);
+
+            checker.checkBlock(plan, midiMessages, result.notes);
+            done += numSamples;
+        }
+
+        checker.finish(result.notes);
+        processor.setPlayHead(nullptr);
+        processor.releaseResources();
+
+        std::sort(microseconds.begin(), microseconds.end());
+        result.numBlocks = microseconds.size();
+        result.p50 = percentile(microseconds, 0.5);
+        result.p99 = percentile(microseconds, 0.99);
+        result.p999 = percentile(microseconds, 0.999);
+        result.max = microseconds.back();
+        result.meanEventsPerBlock = static_cast<double>(totalEvents) / static_cast<double>(result.numBlocks);
+        return result;
+    }
+
+    void printHeader()
+    {
+        std::printf("  %8s %9s %8s %9s %9s %9s %9s %8s %9s %6s %6s %8s %10s\n",
+                    "rate", "block", "blocks", "p50 us", "p99 us", "p99.9 us", "max us", "max/rt",
+                    "ev/block", "max", "late", "dropped", "unexpected");
+    }
+
+    void printResult(const RunResult& result)
+    {
+        const juce::String block = result.blockSize == variedBlockSize ? juce::String(minBlockSize) + "-" + juce::String(maxBlockSize)
+                                                                        : juce::String(result.blockSize);
+
+        std::printf("  %8.0f %9s %8zu %9.2f %9.2f %9.2f %9.2f %7.2f%% %9.2f %6d %6lld %8lld %10lld\n",
+                    result.sampleRate, block.toRawUTF8(), result.numBlocks, result.p50, result.p99, result.p999, result.max,
+                    result.worstBudgetShare * 100.0, result.meanEventsPerBlock, result.maxEventsPerBlock,
+                    static_cast<long long>(result.notes.late), static_cast<long long>(result.notes.dropped),
+                    static_cast<long long>(result.notes.unexpected));
+    }
+
+    /** Plays one score through every configuration. @return False if the score does not compile. */
+    bool runScore(const Score& score, double seconds, unsigned seed, std::vector<RunResult>& results)
+    {
+        // The processor compiles the score its own way; the reference comes from a separate parse
+        EnhancedMMLParser parser;
+
+        if (! parser.parse(std::string_view(score.text)))
+        {
+            std::fprintf(stderr, "%s: %s\n", score.name.c_str(), parser.getError().toRawUTF8());
+            return false;
+        }
+
+        std::vector<MMLProgram> programs;
+
+        for (int i = 0; i < parser.getNumTracks(); i++)
+            programs.push_back(parser.getProgram(i));
+
+        MMLPlugin::MMLPluginProcessor processor;
+
+        if (! processor.processMML(juce::String(score.text)))
+        {
+            std::fprintf(stderr, "%s: %s\n", score.name.c_str(), processor.getErrorMessage().toRawUTF8());
+            return false;
+        }
+
+        std::printf("\n%s - %d track(s)%s\n", score.name.c_str(), parser.getNumTracks(),
+                    parser.isExpanded() ? "" : ", too long to expand: played from bytecode");
+        printHeader();
+
+        Reference reference;
+
+        for (double sampleRate : sampleRates)
+        {
+            buildReference(programs, sampleRate, reference);
+
+            for (int blockSize : blockSizes)
+            {
+                results.push_back(simulate(processor, reference, sampleRate, blockSize, seconds, seed++));
+                printResult(results.back());
+            }
+        }
+
+        return true;
+    }
+
+    void printUsage()
+    {
+        std::printf("Usage: MMLHostSimulator [--seconds <s>] [--score <file.mml>] [--seed <n>]\n"
+                    "  --seconds  Host time played at each sample rate and block size (default 20)\n"
+                    "  --score    Play this score instead of the built-in ones\n"
+                    "  --seed     Seed of the transport script (default 1)\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // The processor's compile worker and change messages need JUCE's message thread set up, not a display
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    double seconds = 20.0;
+    unsigned seed = 1;
+    juce::String scorePath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const juce::String option(argv[i]);
+        const bool hasValue = i + 1 < argc;
+
+        if (option == "--seconds" && hasValue)
+            seconds = juce::jmax(0.1, juce::String(argv[++i]).getDoubleValue());
+        else if (option == "--score" && hasValue)
+            scorePath = argv[++i];
+        else if (option == "--seed" && hasValue)
+            seed = static_cast<unsigned>(juce::String(argv[++i]).getIntValue());
+        else
+        {
+            printUsage();
+            return option == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<Score> scores;
+
+    if (scorePath.isNotEmpty())
+    {
+        const juce::File file(scorePath);
+
+        if (! file.existsAsFile())
+        {
+            std::fprintf(stderr, "Cannot read %s\n", scorePath.toRawUTF8());
+            return 1;
+        }
+
+        scores.push_back({ file.getFileName().toStdString(), file.loadFileAsString().toStdString() });
+    }
+    else
+    {
+        scores.push_back({ "arrangement", makeArrangementScore() });
+        scores.push_back({ "long", makeLongScore() });
+    }
+
+    std::printf("MMLHostSimulator: %.1f s of host time per sample rate and block size, seed %u\n", seconds, seed);
+    std::printf("(max/rt: slowest block as a share of the real time it covers)\n");
+
+    std::vector<RunResult> results;
+
+    for (const Score& score : scores)
+        if (! runScore(score, seconds, seed, results))
+            return 1;
+
+    RunResult worst;
+    NoteCounts notes;
+
+    for (const RunResult& result : results)
+    {
+        if (result.max > worst.max)
+            worst = result;
+
+        notes.late += result.notes.late;
+        notes.dropped += result.notes.dropped;
+        notes.unexpected += result.notes.unexpected;
+    }
+
+    std::printf("\nSlowest block: %.2f us at %.0f Hz; note-ons late %lld, dropped %lld, unexpected %lld\n",
+                worst.max, worst.sampleRate, static_cast<long long>(notes.late),
+                static_cast<long long>(notes.dropped), static_cast<long long>(notes.unexpected));
+
+    return notes.late + notes.dropped + notes.unexpected > 0 ? 1 : 0;
+}
@@ -0,0 +1,521 @@
+/**
+ * MMLParserCheck - Headless consistency checks of the MML parser
+ *
+ * Runs three checks and exits with 1 if any of them fails:
+ *  - corpus: every score in the regression corpus (<name>.mml) still produces the output
+ *    recorded next to it (<name>.expected): the MIDI events with their times, or the error
+ *  - reparse: seeded random edit sequences are applied with reparse() on a parser that is
+ *    kept between edits and with parse() on a new one; the events, tempo map, track
+ *    programs and error messages must be identical, with parallel track parsing on and off
+ *  - normalize: MMLLexer::normalizeWhitespace() matches a plain reference with every
+ *    MMLScanner instruction set the processor supports, and scores that only differ in
+ *    whitespace (and so share a compile cache key) compile to the same events
+ *
+ *   MMLParserCheck [--corpus <directory>] [--update] [--sequences <n>] [--seed <n>]
+ *
+ * --update rewrites the .expected files from the current parser instead of comparing, for
+ * changes that are meant to alter the output. Without --corpus the corpus check is skipped.
+ */
+
+#include <JuceHeader.h>
+#include "EnhancedMMLParser.h"
+#include "MMLLexer.h"
+#include "MMLScanner.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    //==============================================================================
+    // Parser output as text, so that two parses can be compared and a mismatch printed
+
+    /**
+     * Describes what a parse produced: its error, or its events with their times.
+     * @param includePrograms True to append each track's bytecode as well.
+     */
+    std::string describeResult(EnhancedMMLParser& parser, bool succeeded, bool includePrograms)
+    {
+        if (! succeeded)
+            return "error: " + parser.getError().toStdString() + "\n";
+
+        const MMLTempoMap& tempoMap = parser.getTempoMap();
+        std::string text = "tracks " + std::to_string(parser.getNumTracks())
+                         + ", tempo segments " + std::to_string(tempoMap.getNumSegments()) + "\n";
+
+        std::vector<MMLMidiEvent> events;
+        parser.generateEvents(events);
+
+        for (const MMLMidiEvent& event : events)
+        {
+            char line[96];
+            std::snprintf(line, sizeof(line), "%lld %02x %d %d %.9f\n", static_cast<long long>(event.tick),
+                          event.data[0], event.data[1], event.data[2], tempoMap.tickToSeconds(event.tick));
+            text += line;
+        }
+
+        if (includePrograms)
+        {
+            for (int i = 0; i < parser.getNumTracks(); i++)
+            {
+                const MMLProgram& program = parser.getProgram(i);
+                text += "program " + std::to_string(i) + ":";
+
+                for (size_t j = 0; j < program.getSize(); j++)
+                {
+                    char byte[4];
+                    std::snprintf(byte, sizeof(byte), " %02x", program.getData()[j]);
+                    text += byte;
+                }
+
+                text += "\n";
+            }
+        }
+
+        return text;
+    }
+
+    template <typename Value>
+    void appendBytes(std::string& bytes, const Value& value)
+    {
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    /**
+     * Records the same as describeResult() as raw bytes, which is much cheaper to build
+     * for the many parses of the random checks; describeResult() is only called to print
+     * a mismatch.
+     */
+    std::string captureResult(EnhancedMMLParser& parser, bool succeeded, bool includePrograms)
+    {
+        if (! succeeded)
+            return "error: " + parser.getError().toStdString();
+
+        const MMLTempoMap& tempoMap = parser.getTempoMap();
+        std::string bytes;
+        appendBytes(bytes, parser.getNumTracks());
+        appendBytes(bytes, tempoMap.getNumSegments());
+
+        std::vector<MMLMidiEvent> events;
+        parser.generateEvents(events);
+
+        for (const MMLMidiEvent& event : events)
+        {
+            appendBytes(bytes, event.tick);
+            bytes.append(reinterpret_cast<const char*>(event.data), sizeof(event.data));
+            appendBytes(bytes, tempoMap.tickToSeconds(event.tick));
+        }
+
+        if (includePrograms)
+        {
+            for (int i = 0; i < parser.getNumTracks(); i++)
+            {
+                const MMLProgram& program = parser.getProgram(i);
+                appendBytes(bytes, program.getSize());
+                bytes.append(reinterpret_cast<const char*>(program.getData()), program.getSize());
+            }
+        }
+
+        return bytes;
+    }
+
+    void printMismatch(const char* check, const std::string& input, const std::string& expected, const std::string& actual)
+    {
+        std::fprintf(stderr, "%s: mismatch for input:\n%s\n--- expected\n%.2000s\n--- actual\n%.2000s\n",
+                     check, input.c_str(), expected.c_str(), actual.c_str());
+    }
+
+    //==============================================================================
+    // Regression corpus
+
+    bool checkCorpus(const juce::File& directory, bool update)
+    {
+        auto files = directory.findChildFiles(juce::File::findFiles, false, "*.mml");
+        files.sort();
+
+        if (files.isEmpty())
+        {
+            std::fprintf(stderr, "corpus: no .mml files in %s\n", directory.getFullPathName().toRawUTF8());
+            return false;
+        }
+
+        int failures = 0;
+
+        for (const juce::File& file : files)
+        {
+            juce::MemoryBlock data;
+
+            if (! file.loadFileAsData(data))
+            {
+                std::fprintf(stderr, "corpus: could not read %s\n", file.getFullPathName().toRawUTF8());
+                failures++;
+                continue;
+            }
+
+            const std::string source(static_cast<const char*>(data.getData()), data.getSize());
+            EnhancedMMLParser parser;
+            const bool succeeded = parser.parse(std::string_view(source));
+            const std::string actual = describeResult(parser, succeeded, false);
+            const juce::File expectedFile = file.withFileExtension("expected");
+
+            if (update)
+            {
+                if (! expectedFile.replaceWithData(actual.data(), actual.size()))
+                {
+                    std::fprintf(stderr, "corpus: could not write %s\n", expectedFile.getFullPathName().toRawUTF8());
+                    failures++;
+                }
+
+                continue;
+            }
+
+            juce::MemoryBlock expectedData;
+
+            if (! expectedFile.loadFileAsData(expectedData))
+            {
+                std::fprintf(stderr, "corpus: %s has no .expected file (run with --update)\n", file.getFileName().toRawUTF8());
+                failures++;
+                continue;
+            }
+
+            const std::string expected(static_cast<const char*>(expectedData.getData()), expectedData.getSize());
+
+            if (actual != expected)
+            {
+                printMismatch("corpus", file.getFileName().toStdString(), expected, actual);
+                failures++;
+            }
+        }
+
+        std::printf("corpus: %d score(s)%s, %d failure(s)\n", files.size(), update ? " written" : "", failures);
+        return failures == 0;
+    }
+
+    //==============================================================================
+    // Random scores and edits. Scores are built from valid fragments, so that most edits
+    // leave a score that compiles and reparse() can reuse the unchanged part of; edits
+    // sometimes insert a fragment that breaks the score instead.
+
+    template <size_t size>
+    const char* pickFragment(const char* const (&fragments)[size], std::mt19937& random)
+    {
+        return fragments[std::uniform_int_distribution<size_t>(0, size - 1)(random)];
+    }
+
+    std::string randomFragment(std::mt19937& random)
+    {
+        static const char* const fragments[] = {
+            "c", "d4", "e8.", "f+", "g-16", "a&", "b", "r4", "r8.", "c7", "o5", "o3", ">", "<",
+            "l8", "l16.", "t140", "t90", "v80", "v10", "/* x */", "// y\n", " ", "  ", "\t", "\n",
+            "\r\n", "ceg", "[cde]2", "[c [d e]3 f]*2", "{ceg}8", "{c8 d e}4", "t200 c"
+        };
+
+        return pickFragment(fragments, random);
+    }
+
+    std::string randomBreakingFragment(std::mt19937& random)
+    {
+        static const char* const fragments[] = {
+            "[", "]", "]3", "]*2", "{", "}4", "}", "{v80}", "4", "8", ".", "*", "+", "#", "-", "&", "^",
+            "/", "x", "o9", "t10", ";", "[c]200"
+        };
+
+        return pickFragment(fragments, random);
+    }
+
+    /** Builds a score of one to four tracks. */
+    std::string randomScore(std::mt19937& random, int numFragments)
+    {
+        const int numTracks = std::uniform_int_distribution<int>(1, 4)(random);
+        std::string text;
+
+        for (int track = 0; track < numTracks; track++)
+        {
+            if (track > 0)
+                text += std::uniform_int_distribution<int>(0, 1)(random) == 0 ? ";" : ";\n";
+
+            for (int i = 0; i < numFragments / numTracks; i++)
+                text += randomFragment(random);
+        }
+
+        return text;
+    }
+
+    /** Inserts, erases or overwrites a few bytes at a random position, as typing would. */
+    std::string randomEdit(std::string text, std::mt19937& random)
+    {
+        const size_t position = std::uniform_int_distribution<size_t>(0, text.size())(random);
+
+        switch (std::uniform_int_distribution<int>(0, 2)(random))
+        {
+            case 0:
+                text.insert(position, std::uniform_int_distribution<int>(0, 9)(random) == 0 ? randomBreakingFragment(random)
+                                                                                              : randomFragment(random));
+                break;
+
+            case 1:
+                if (position < text.size())
+                    text.erase(position, std::uniform_int_distribution<size_t>(1, 8)(random));
+                break;
+
+            default:
+            {
+                const std::string fragment = randomFragment(random);
+
+                if (position < text.size())
+                    text.replace(position, std::min(fragment.size(), text.size() - position), fragment);
+                break;
+            }
+        }
+
+        return text;
+    }
+
+    //==============================================================================
+    // reparse() against parse()
+
+    bool checkReparse(int numSequences, unsigned int seed)
+    {
+        constexpr int editsPerSequence = 30;
+        int failures = 0;
+
+        for (bool parallel : { false, true })
+        {
+            std::mt19937 random(seed);
+
+            for (int sequence = 0; sequence < numSequences && failures == 0; sequence++)
+            {
+                EnhancedMMLParser kept;
+                kept.setParallelTrackParsing(parallel);
+
+                std::string text = randomScore(random, std::uniform_int_distribution<int>(5, 1000)(random));
+                std::string lastValidText = text;
+                kept.reparse(std::string_view(text));
+
+                for (int edit = 0; edit < editsPerSequence; edit++)
+                {
+                    const std::string editedText = randomEdit(text, random);
+
+                    EnhancedMMLParser fresh;
+                    fresh.setParallelTrackParsing(false);
+
+                    const bool keptSucceeded = kept.reparse(std::string_view(editedText));
+                    const bool freshSucceeded = fresh.parse(std::string_view(editedText));
+                    if (captureResult(kept, keptSucceeded, true) != captureResult(fresh, freshSucceeded, true))
+                    {
+                        printMismatch(parallel ? "reparse (parallel)" : "reparse", editedText,
+                                      describeResult(fresh, freshSucceeded, true), describeResult(kept, keptSucceeded, true));
+                        failures++;
+                        break;
+                    }
+
+                    // Most edits that break the score are undone, as when typing, so that
+                    // reparse() is mostly checked against a previous parse that succeeded
+                    if (freshSucceeded)
+                        text = lastValidText = editedText;
+                    else
+                        text = std::uniform_int_distribution<int>(0, 3)(random) == 0 ? editedText : lastValidText;
+                }
+            }
+        }
+
+        std::printf("reparse: %d edit sequence(s) of %d edits, serial and parallel, %d failure(s)\n",
+                    numSequences, editsPerSequence, failures);
+        return failures == 0;
+    }
+
+    //==============================================================================
+    // normalizeWhitespace() and the compile cache key
+
+    bool isWhitespace(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    /** The canonical form as documented, one byte at a time. */
+    std::string normalizeReference(std::string_view source)
+    {
+        std::string normalized;
+        size_t position = 0;
+
+        while (position < source.size())
+        {
+            if (! isWhitespace(source[position]))
+            {
+                normalized += source[position++];
+                continue;
+            }
+
+            bool hasNewline = false;
+
+            for (; position < source.size() && isWhitespace(source[position]); position++)
+                hasNewline = hasNewline || source[position] == '\n';
+
+            if (! normalized.empty() && position < source.size())
+                normalized += hasNewline ? '\n' : ' ';
+        }
+
+        return normalized;
+    }
+
+    /** Replaces every whitespace run with a different one of the same kind, and pads both ends. */
+    std::string respace(std::string_view source, std::mt19937& random)
+    {
+        static const char spaces[] = { ' ', '\t', '\r', '\f', '\v' };
+        auto randomRun = [&random] (bool hasNewline)
+        {
+            std::string run(std::uniform_int_distribution<size_t>(1, 40)(random), ' ');
+
+            for (char& c : run)
+                c = spaces[std::uniform_int_distribution<size_t>(0, std::size(spaces) - 1)(random)];
+
+            if (hasNewline)
+                run[std::uniform_int_distribution<size_t>(0, run.size() - 1)(random)] = '\n';
+
+            return run;
+        };
+
+        std::string text = randomRun(false);
+        size_t position = 0;
+
+        while (position < source.size())
+        {
+            if (! isWhitespace(source[position]))
+            {
+                text += source[position++];
+                continue;
+            }
+
+            bool hasNewline = false;
+
+            for (; position < source.size() && isWhitespace(source[position]); position++)
+                hasNewline = hasNewline || source[position] == '\n';
+
+            text += randomRun(hasNewline);
+        }
+
+        return text + randomRun(std::uniform_int_distribution<int>(0, 1)(random) == 0);
+    }
+
+    const char* getInstructionSetName(MMLScanner::InstructionSet instructionSet)
+    {
+        switch (instructionSet)
+        {
+            case MMLScanner::InstructionSet::AVX2: return "avx2";
+            case MMLScanner::InstructionSet::SSE2: return "sse2";
+            case MMLScanner::InstructionSet::Scalar: break;
+        }
+
+        return "scalar";
+    }
+
+    bool checkNormalize(int numSequences, unsigned int seed)
+    {
+        const auto bestInstructionSet = MMLScanner::getBestSupportedInstructionSet();
+        std::mt19937 random(seed);
+        std::string normalized;
+        int failures = 0;
+
+        for (int i = 0; i < numSequences && failures == 0; i++)
+        {
+            const std::string text = randomScore(random, std::uniform_int_distribution<int>(5, 400)(random));
+            const std::string variant = respace(text, random);
+            const std::string expected = normalizeReference(text);
+
+            for (auto instructionSet : { MMLScanner::InstructionSet::Scalar, MMLScanner::InstructionSet::SSE2, MMLScanner::InstructionSet::AVX2 })
+            {
+                if (instructionSet > bestInstructionSet)
+                    break;
+
+                MMLScanner::setInstructionSet(instructionSet);
+
+                for (const std::string* input : { &text, &variant })
+                {
+                    MMLLexer::normalizeWhitespace(*input, normalized);
+
+                    if (normalized != expected)
+                    {
+                        printMismatch("normalize", *input, expected, normalized);
+                        failures++;
+                    }
+                }
+            }
+
+            MMLScanner::setInstructionSet(bestInstructionSet);
+
+            // Only successful compiles are cached, and error positions are allowed to differ
+            EnhancedMMLParser original;
+            EnhancedMMLParser respaced;
+            const bool originalSucceeded = original.parse(std::string_view(text));
+            const bool respacedSucceeded = respaced.parse(std::string_view(variant));
+
+            if (originalSucceeded != respacedSucceeded
+                || (originalSucceeded && captureResult(original, true, false) != captureResult(respaced, true, false)))
+            {
+                printMismatch("normalize (same cache key)", text + "\n--- respaced\n" + variant,
+                              describeResult(original, originalSucceeded, false), describeResult(respaced, respacedSucceeded, false));
+                failures++;
+            }
+        }
+
+        std::printf("normalize: %d score(s), scanner up to %s, %d failure(s)\n", numSequences,
+                    getInstructionSetName(bestInstructionSet), failures);
+        return failures == 0;
+    }
+
+    void printUsage()
+    {
+        std::printf("Usage: MMLParserCheck [--corpus <directory>] [--update] [--sequences <n>] [--seed <n>]\n"
+                    "  --corpus     Directory of .mml scores with their .expected output\n"
+                    "  --update     Rewrite the .expected files instead of comparing them\n"
+                    "  --sequences  Random edit sequences and scores per check (default 200)\n"
+                    "  --seed       Seed of the random scores and edits (default 12345)\n");
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    juce::File corpusDirectory;
+    bool update = false;
+    int numSequences = 200;
+    unsigned int seed = 12345;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const juce::String option(argv[i]);
+        const bool hasValue = i + 1 < argc;
+
+        if (option == "--corpus" && hasValue)
+            corpusDirectory = juce::File::getCurrentWorkingDirectory().getChildFile(argv[++i]);
+        else if (option == "--update")
+            update = true;
+        else if (option == "--sequences" && hasValue)
+            numSequences = juce::jmax(1, juce::String(argv[++i]).getIntValue());
+        else if (option == "--seed" && hasValue)
+            seed = static_cast<unsigned int>(juce::String(argv[++i]).getLargeIntValue());
+        else
+        {
+            printUsage();
+            return option == "--help" ? 0 : 1;
+        }
+    }
+
+    bool passed = true;
+
+    if (corpusDirectory != juce::File())
+        passed = checkCorpus(corpusDirectory, update) && passed;
+    else
+        std::printf("corpus: skipped (no --corpus)\n");
+
+    if (update)
+        return passed ? 0 : 1;
+
+    passed = checkReparse(numSequences, seed) && passed;
+    passed = checkNormalize(numSequences, seed) && passed;
+
+    return passed ? 0 : 1;
+}